@@ -317,6 +317,11 @@ void InspectorWidgetProcessorWrapper::AccessibilityHover(const Nan::FunctionCall
 
 void InspectorWidgetProcessorWrapper::ExtractTemplate(const Nan::FunctionCallbackInfo<v8::Value>& info) {
     int argc = info.Length();
+    /// Batch form: id, array of [name, x, y, w, h, time] arrays, callback
+    if (argc == 3 && info[0]->IsString()) {
+        ExtractTemplates(info);
+        return;
+    }
     if (argc != 8) {
         Nan::ThrowTypeError("Wrong number of arguments");
         return;
@@ -370,6 +375,69 @@ void InspectorWidgetProcessorWrapper::ExtractTemplate(const Nan::FunctionCallbac
     callback->Call(3, argv);
 }
 
+void InspectorWidgetProcessorWrapper::ExtractTemplates(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+    int argc = info.Length();
+    if(!info[1]->IsArray()){
+        Nan::ThrowTypeError("Argument 1 should be an array");
+        return;
+    }
+    if(!info[argc-1]->IsFunction()){
+        Nan::ThrowTypeError("The last argument should be a callback function");
+        return;
+    }
+
+    v8::String::Utf8Value id_arg(info[0]);
+    std::string id_string = std::string(*id_arg);
+
+    v8::Local<v8::Array> templates = info[1].As<v8::Array>();
+    std::vector<InspectorWidgetTemplateRequest> requests;
+    for (unsigned i=0; i<templates->Length(); i++){
+        if(!templates->Get(i)->IsArray() || templates->Get(i).As<v8::Array>()->Length() != 6){
+            std::stringstream error;
+            error << "Template " << i << " should be an array of name, x, y, w, h and time";
+            Nan::ThrowTypeError(error.str().c_str());
+            return;
+        }
+        v8::Local<v8::Array> fields = templates->Get(i).As<v8::Array>();
+        std::vector<std::string> args;
+        for (unsigned f=0; f<fields->Length(); f++){
+            v8::String::Utf8Value arg(fields->Get(f));
+            args.push_back(std::string(*arg));
+        }
+        InspectorWidgetTemplateRequest request;
+        request.name = args[0];
+        request.x = atof(args[1].c_str());
+        request.y = atof(args[2].c_str());
+        request.w = atof(args[3].c_str());
+        request.h = atof(args[4].c_str());
+        request.time = atof(args[5].c_str());
+        requests.push_back(request);
+    }
+
+    Nan::Callback *callback = new Nan::Callback(info[argc-1].As<v8::Function>());
+
+    InspectorWidgetProcessorWrapper* obj = ObjectWrap::Unwrap<InspectorWidgetProcessorWrapper>(info.Holder());
+
+    v8::Local<v8::Value> error = Nan::Null();
+    if(obj->getServer()){
+        bool success = obj->getServer()->extractTemplates(requests,id_string);
+        std::string error_string = success ? "":"Could not extract templates";
+        error = Nan::New(error_string.c_str()).ToLocalChecked();
+    }
+    v8::Local<v8::Value> id = Nan::New(id_string).ToLocalChecked();
+    v8::Local<v8::Array> names = Nan::New<v8::Array>(requests.size());
+    for (unsigned i=0; i < requests.size(); i++) {
+        names->Set( i, Nan::New(requests[i].name).ToLocalChecked() );
+    }
+
+    v8::Local<v8::Value> argv[] = {
+        id
+        ,names
+        ,error
+    };
+    callback->Call(3, argv);
+}
+
 void InspectorWidgetProcessorWrapper::AnnotationStatus(const Nan::FunctionCallbackInfo<v8::Value>& info) {
     int argc = info.Length();
     if (argc != 3) {
@@ -28,6 +28,7 @@ class InspectorWidgetProcessorWrapper : public Nan::ObjectWrap {
     static void AnnotationStatus(const Nan::FunctionCallbackInfo<v8::Value>& info);
     static void AccessibilityHover(const Nan::FunctionCallbackInfo<v8::Value>& info);
     static void ExtractTemplate(const Nan::FunctionCallbackInfo<v8::Value>& info);
+    static void ExtractTemplates(const Nan::FunctionCallbackInfo<v8::Value>& info);
     static Nan::Persistent<v8::Function> constructor;
     InspectorWidgetProcessor* server;
 };
@@ -0,0 +1,296 @@
+/**
+ * @file InspectorWidgetLumaCapture.cpp
+ * @brief Video capture decoding grayscale frames from the luma plane
+ * @author Christian Frisson
+ */
+
+#include "InspectorWidgetLumaCapture.h"
+
+#include <cmath>
+#include <algorithm>
+
+#ifdef HAVE_FFMPEG
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+#endif
+
+#if CV_MAJOR_VERSION < 3
+#define CAP_PROP_POS_MSEC CV_CAP_PROP_POS_MSEC
+#define CAP_PROP_POS_FRAMES CV_CAP_PROP_POS_FRAMES
+#define CAP_PROP_FRAME_WIDTH CV_CAP_PROP_FRAME_WIDTH
+#define CAP_PROP_FRAME_HEIGHT CV_CAP_PROP_FRAME_HEIGHT
+#define CAP_PROP_FPS CV_CAP_PROP_FPS
+#define CAP_PROP_FRAME_COUNT CV_CAP_PROP_FRAME_COUNT
+#else
+using namespace cv;
+#endif
+
+InspectorWidgetLumaCapture::InspectorWidgetLumaCapture()
+    :luma(false),format(0),codec(0),frame(0),packet(0),stream(-1),width(0),height(0),time_base(0),fps(0),first(0),frames(0),position(0),pending(false),grabbed(false),limited_range(false){
+}
+
+InspectorWidgetLumaCapture::~InspectorWidgetLumaCapture(){
+    release();
+}
+
+void InspectorWidgetLumaCapture::setLuma(bool luma){
+    this->luma = luma;
+}
+
+bool InspectorWidgetLumaCapture::isLuma() const{
+    return codec != 0;
+}
+
+bool InspectorWidgetLumaCapture::open(const Filename& filename){
+    release();
+    if(luma && openLuma(filename)){
+        return true;
+    }
+    return cv::VideoCapture::open(filename);
+}
+
+bool InspectorWidgetLumaCapture::openLuma(const std::string& filename){
+#ifdef HAVE_FFMPEG
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58,9,100)
+    av_register_all();
+#endif
+    if(avformat_open_input(&format, filename.c_str(), 0, 0) < 0){
+        format = 0;
+        return false;
+    }
+#if LIBAVFORMAT_VERSION_MAJOR >= 59
+    const AVCodec* decoder = 0;
+#else
+    AVCodec* decoder = 0;
+#endif
+    if(avformat_find_stream_info(format, 0) >= 0){
+        stream = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+    }
+    if(stream < 0 || !decoder){
+        release();
+        return false;
+    }
+    AVStream* video = format->streams[stream];
+    codec = avcodec_alloc_context3(decoder);
+    if(!codec || avcodec_parameters_to_context(codec, video->codecpar) < 0 || avcodec_open2(codec, decoder, 0) < 0){
+        release();
+        return false;
+    }
+
+    /// Only 8 bit YUV formats store the luma plane as a grayscale image
+    bool full_range = false;
+    switch(codec->pix_fmt){
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUVJ444P:
+        full_range = true;
+        break;
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+        full_range = (codec->color_range == AVCOL_RANGE_JPEG);
+        break;
+    default:
+        release();
+        return false;
+    }
+    limited_range = !full_range;
+
+    frame = av_frame_alloc();
+    packet = av_packet_alloc();
+    width = codec->width;
+    height = codec->height;
+    time_base = av_q2d(video->time_base);
+    fps = av_q2d(av_guess_frame_rate(format, video, 0));
+    first = (video->start_time == AV_NOPTS_VALUE) ? 0 : video->start_time;
+    frames = (int)video->nb_frames;
+    if(frames <= 0 && format->duration != AV_NOPTS_VALUE){
+        frames = (int)floor((double)format->duration/AV_TIME_BASE*fps + 0.5);
+    }
+    if(!frame || !packet || fps <= 0){
+        release();
+        return false;
+    }
+    position = 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool InspectorWidgetLumaCapture::isOpened() const{
+    return codec != 0 || cv::VideoCapture::isOpened();
+}
+
+void InspectorWidgetLumaCapture::release(){
+#ifdef HAVE_FFMPEG
+    if(packet){
+        av_packet_free(&packet);
+    }
+    if(frame){
+        av_frame_free(&frame);
+    }
+    if(codec){
+        avcodec_free_context(&codec);
+    }
+    if(format){
+        avformat_close_input(&format);
+    }
+#endif
+    packet = 0;
+    frame = 0;
+    codec = 0;
+    format = 0;
+    stream = -1;
+    pending = false;
+    grabbed = false;
+    cv::VideoCapture::release();
+}
+
+bool InspectorWidgetLumaCapture::decodeFrame(){
+#ifdef HAVE_FFMPEG
+    while(true){
+        int received = avcodec_receive_frame(codec, frame);
+        if(received == 0){
+            position = frameNumber() + 1;
+            return true;
+        }
+        if(received != AVERROR(EAGAIN)){
+            return false;
+        }
+        bool sent = false;
+        while(!sent){
+            if(av_read_frame(format, packet) < 0){
+                /// At the end of the file the decoder returns the frames it still holds
+                if(avcodec_send_packet(codec, 0) < 0){
+                    return false;
+                }
+                sent = true;
+            }
+            else{
+                if(packet->stream_index == stream){
+                    sent = (avcodec_send_packet(codec, packet) >= 0);
+                }
+                av_packet_unref(packet);
+            }
+        }
+    }
+#else
+    return false;
+#endif
+}
+
+int InspectorWidgetLumaCapture::frameNumber() const{
+#ifdef HAVE_FFMPEG
+    long long timestamp = frame->best_effort_timestamp;
+    if(timestamp == AV_NOPTS_VALUE){
+        return position;
+    }
+    return (int)floor((timestamp - first)*time_base*fps + 0.5);
+#else
+    return position;
+#endif
+}
+
+bool InspectorWidgetLumaCapture::grab(){
+    if(!codec){
+        return cv::VideoCapture::grab();
+    }
+    /// A seek leaves its target frame decoded
+    if(pending){
+        pending = false;
+        grabbed = true;
+        position++;
+        return true;
+    }
+    grabbed = decodeFrame();
+    return grabbed;
+}
+
+bool InspectorWidgetLumaCapture::retrieve(Image image, int flag){
+    if(!codec){
+        return cv::VideoCapture::retrieve(image, flag);
+    }
+    if(!grabbed){
+        return false;
+    }
+#ifdef HAVE_FFMPEG
+    cv::Mat plane(frame->height, frame->width, CV_8UC1, frame->data[0], frame->linesize[0]);
+    /// Limited range luma is stretched to the full range, close to but not equal to grayscale converted BGR frames
+    if(limited_range){
+        plane.convertTo(image, CV_8U, 255.0/219.0, -16*255.0/219.0);
+    }
+    else{
+        plane.copyTo(image);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool InspectorWidgetLumaCapture::read(Image image){
+    if(!codec){
+        return cv::VideoCapture::read(image);
+    }
+    return grab() && retrieve(image);
+}
+
+bool InspectorWidgetLumaCapture::set(int propId, double value){
+    if(!codec){
+        return cv::VideoCapture::set(propId, value);
+    }
+    if(propId != CAP_PROP_POS_FRAMES && propId != CAP_PROP_POS_MSEC){
+        return false;
+    }
+#ifdef HAVE_FFMPEG
+    /// Times are seeked to as given, so that indexed presentation times land on their keyframe
+    double seconds = (propId == CAP_PROP_POS_MSEC) ? std::max(0.0,value)/1000 : std::max(0,(int)value)/fps;
+    int target = (int)floor(seconds*fps + 0.5);
+    long long timestamp = first + (long long)floor(seconds/time_base + 0.5);
+    if(av_seek_frame(format, stream, timestamp, AVSEEK_FLAG_BACKWARD) < 0){
+        return false;
+    }
+    avcodec_flush_buffers(codec);
+    pending = false;
+    grabbed = false;
+
+    /// Frames are decoded from the preceding keyframe until the target
+    do{
+        if(!decodeFrame()){
+            return false;
+        }
+    } while(frameNumber() < target);
+    pending = true;
+    position = frameNumber();
+    return true;
+#else
+    return false;
+#endif
+}
+
+double InspectorWidgetLumaCapture::get(int propId) const{
+    if(!codec){
+        return cv::VideoCapture::get(propId);
+    }
+    switch(propId){
+    case CAP_PROP_FRAME_WIDTH:
+        return width;
+    case CAP_PROP_FRAME_HEIGHT:
+        return height;
+    case CAP_PROP_FPS:
+        return fps;
+    case CAP_PROP_FRAME_COUNT:
+        return frames;
+    case CAP_PROP_POS_FRAMES:
+        return position;
+    case CAP_PROP_POS_MSEC:
+        return position > 0 ? 1000.0*(position-1)/fps : 0;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,70 @@
+/**
+ * @file InspectorWidgetLumaCapture.h
+ * @brief Video capture decoding grayscale frames from the luma plane
+ * @author Christian Frisson
+ */
+
+#ifndef InspectorWidgetLumaCapture_H
+#define InspectorWidgetLumaCapture_H
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+
+/// Video capture returning the luma plane of planar YUV videos as grayscale frames, decoded with FFmpeg
+/// Behaves as cv::VideoCapture when luma decoding is off, FFmpeg is not available or the pixel format is not supported
+class InspectorWidgetLumaCapture : public cv::VideoCapture {
+public:
+#if CV_MAJOR_VERSION >= 3
+    typedef cv::String Filename;
+    typedef cv::OutputArray Image;
+#else
+    typedef std::string Filename;
+    typedef cv::Mat& Image;
+#endif
+    InspectorWidgetLumaCapture();
+    virtual ~InspectorWidgetLumaCapture();
+
+    /// Takes effect at the next open
+    void setLuma(bool luma);
+    bool isLuma() const;
+
+    virtual bool open(const Filename& filename);
+    virtual bool isOpened() const;
+    virtual void release();
+    virtual bool grab();
+    virtual bool retrieve(Image image, int flag = 0);
+    virtual bool read(Image image);
+    virtual bool set(int propId, double value);
+    virtual double get(int propId) const;
+
+private:
+    bool openLuma(const std::string& filename);
+    bool decodeFrame();
+    int frameNumber() const;
+
+    bool luma;
+    AVFormatContext* format;
+    AVCodecContext* codec;
+    AVFrame* frame;
+    AVPacket* packet;
+    int stream;
+    int width;
+    int height;
+    double time_base;
+    double fps;
+    long long first;
+    int frames;
+    int position;
+    bool pending;
+    bool grabbed;
+    bool limited_range;
+};
+
+#endif
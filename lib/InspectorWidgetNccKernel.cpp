@@ -0,0 +1,234 @@
+/**
+ * @file InspectorWidgetNccKernel.cpp
+ * @brief Vectorized normalized cross-correlation of 8-bit grayscale templates
+ * @author Christian Frisson
+ */
+
+#include "InspectorWidgetNccKernel.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define NCC_KERNEL_X86
+#include <immintrin.h>
+/// SIMD functions are compiled for their instruction set whatever the flags of the build, and only called when the CPU supports it
+#if defined(__GNUC__) || defined(__clang__)
+#define NCC_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NCC_KERNEL_TARGET(isa)
+#endif
+#endif
+
+/// Correlations are computed for chunks of positions of a row, with integer sums of products of pixels
+const int ncc_kernel_chunk = 256;
+
+/// Correlations of the windows of positions [begin,end) of a row, rows holding the image rows under the template
+/// Template pixels are taken in pairs, each pair of a row packing its two weights in the low and high 16 bits of an int
+int correlateScalar(const uchar* const* rows, const int* pairs, int w, int h, int begin, int end, int* out){
+    int half = (w+1)/2;
+    for(int x = begin; x < end; x++){
+        int sum = 0;
+        for(int j = 0; j < h; j++){
+            const uchar* row = rows[j] + x;
+            const int* p = pairs + j*half;
+            for(int k = 0; k < w/2; k++){
+                sum += row[2*k]*(p[k] & 0xffff) + row[2*k+1]*(p[k] >> 16);
+            }
+            if(w & 1){
+                sum += row[w-1]*p[half-1];
+            }
+        }
+        out[x] = sum;
+    }
+    return end;
+}
+
+#ifdef NCC_KERNEL_X86
+/// 8 positions at a time: pixels under both weights of a pair are interleaved to be multiplied and added by _mm_madd_epi16
+NCC_KERNEL_TARGET("sse4.1")
+int correlateSse4(const uchar* const* rows, const int* pairs, int w, int h, int begin, int end, int* out){
+    int half = (w+1)/2;
+    int x = begin;
+    const __m128i zero = _mm_setzero_si128();
+    for(; x + 8 <= end; x += 8){
+        __m128i low = zero, high = zero;
+        for(int j = 0; j < h; j++){
+            const uchar* row = rows[j] + x;
+            const int* p = pairs + j*half;
+            for(int k = 0; k < w/2; k++){
+                __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(row + 2*k)));
+                __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(row + 2*k + 1)));
+                __m128i weights = _mm_set1_epi32(p[k]);
+                low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+                high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+            }
+            if(w & 1){
+                /// The last pixel of odd rows is paired with zeros, so that loads stay within the row
+                __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(row + w - 1)));
+                __m128i weights = _mm_set1_epi32(p[half-1]);
+                low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), weights));
+                high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), weights));
+            }
+        }
+        _mm_storeu_si128((__m128i*)(out + x), low);
+        _mm_storeu_si128((__m128i*)(out + x + 4), high);
+    }
+    return x;
+}
+
+/// 16 positions at a time, interleaving within each 128 bit lane so the halves are reordered when stored
+NCC_KERNEL_TARGET("avx2")
+int correlateAvx2(const uchar* const* rows, const int* pairs, int w, int h, int begin, int end, int* out){
+    int half = (w+1)/2;
+    int x = begin;
+    const __m256i zero = _mm256_setzero_si256();
+    for(; x + 16 <= end; x += 16){
+        __m256i low = zero, high = zero;
+        for(int j = 0; j < h; j++){
+            const uchar* row = rows[j] + x;
+            const int* p = pairs + j*half;
+            for(int k = 0; k < w/2; k++){
+                __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + 2*k)));
+                __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + 2*k + 1)));
+                __m256i weights = _mm256_set1_epi32(p[k]);
+                low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights));
+                high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights));
+            }
+            if(w & 1){
+                __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + w - 1)));
+                __m256i weights = _mm256_set1_epi32(p[half-1]);
+                low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), weights));
+                high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), weights));
+            }
+        }
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_permute2x128_si256(low, high, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + x + 8), _mm256_permute2x128_si256(low, high, 0x31));
+    }
+    return x;
+}
+#endif
+
+InspectorWidgetNccKernelLevel detectNccKernelLevel(){
+#if defined(NCC_KERNEL_X86) && defined(CV_CPU_AVX2)
+    if(cv::checkHardwareSupport(CV_CPU_AVX2)){
+        return NCC_KERNEL_AVX2;
+    }
+#endif
+#if defined(NCC_KERNEL_X86) && defined(CV_CPU_SSE4_1)
+    if(cv::checkHardwareSupport(CV_CPU_SSE4_1)){
+        return NCC_KERNEL_SSE4;
+    }
+#endif
+    return NCC_KERNEL_SCALAR;
+}
+
+InspectorWidgetNccKernelLevel nccKernelLevel(){
+    static InspectorWidgetNccKernelLevel level = detectNccKernelLevel();
+    return level;
+}
+
+const char* nccKernelName(InspectorWidgetNccKernelLevel level){
+    switch(level){
+    case NCC_KERNEL_AVX2:
+        return "AVX2";
+    case NCC_KERNEL_SSE4:
+        return "SSE4.1";
+    default:
+        return "scalar";
+    }
+}
+
+bool matchTemplateNcc(const cv::Mat& ref, const cv::Mat& tpl, cv::Mat& res, const cv::Mat& sums, const cv::Mat& sqsums, cv::Point offset, InspectorWidgetNccKernelLevel level){
+    if(ref.type() != CV_8UC1 || tpl.type() != CV_8UC1 || tpl.empty() || tpl.cols > ncc_kernel_max_size || tpl.rows > ncc_kernel_max_size
+            || ref.cols < tpl.cols || ref.rows < tpl.rows){
+        return false;
+    }
+    if(sums.type() != CV_64F || sqsums.type() != CV_64F || offset.x < 0 || offset.y < 0
+            || sums.rows < offset.y + ref.rows + 1 || sums.cols < offset.x + ref.cols + 1
+            || sqsums.rows != sums.rows || sqsums.cols != sums.cols){
+        return false;
+    }
+    level = std::min(level, nccKernelLevel());
+
+    int w = tpl.cols, h = tpl.rows;
+    int result_cols = ref.cols - w + 1;
+    int result_rows = ref.rows - h + 1;
+    res.create(result_rows, result_cols, CV_32FC1);
+
+    /// Template pixels packed by pairs, with the template terms of the normalization
+    int half = (w+1)/2;
+    int pairs[ncc_kernel_max_size*(ncc_kernel_max_size/2)];
+    double templ_sum = 0, templ_sqsum = 0;
+    for(int j = 0; j < h; j++){
+        const uchar* row = tpl.ptr(j);
+        for(int k = 0; k < half; k++){
+            int first = row[2*k];
+            int second = (2*k + 1 < w) ? row[2*k+1] : 0;
+            pairs[j*half + k] = first | (second << 16);
+        }
+        for(int i = 0; i < w; i++){
+            templ_sum += row[i];
+            templ_sqsum += row[i]*row[i];
+        }
+    }
+    double n = (double)w*h;
+    double templ_mean = templ_sum/n;
+    double templ_norm = std::sqrt(std::max(templ_sqsum - templ_sum*templ_mean, 0.0));
+    /// Flat templates match everywhere, as with cv::matchTemplate
+    if(templ_norm < DBL_EPSILON){
+        res.setTo(cv::Scalar(1));
+        return true;
+    }
+
+    const uchar* rows[ncc_kernel_max_size];
+    const uchar* chunk_rows[ncc_kernel_max_size];
+    int correlations[ncc_kernel_chunk];
+    for(int y = 0; y < result_rows; y++){
+        for(int j = 0; j < h; j++){
+            rows[j] = ref.ptr(y + j);
+        }
+        const double* s0 = sums.ptr<double>(offset.y + y) + offset.x;
+        const double* s1 = sums.ptr<double>(offset.y + y + h) + offset.x;
+        const double* q0 = sqsums.ptr<double>(offset.y + y) + offset.x;
+        const double* q1 = sqsums.ptr<double>(offset.y + y + h) + offset.x;
+        float* scores = res.ptr<float>(y);
+        for(int start = 0; start < result_cols; start += ncc_kernel_chunk){
+            int count = std::min(ncc_kernel_chunk, result_cols - start);
+            for(int j = 0; j < h; j++){
+                chunk_rows[j] = rows[j] + start;
+            }
+            int x = 0;
+#ifdef NCC_KERNEL_X86
+            if(level >= NCC_KERNEL_AVX2){
+                x = correlateAvx2(chunk_rows, pairs, w, h, x, count, correlations);
+            }
+            if(level >= NCC_KERNEL_SSE4){
+                x = correlateSse4(chunk_rows, pairs, w, h, x, count, correlations);
+            }
+#endif
+            correlateScalar(chunk_rows, pairs, w, h, x, count, correlations);
+
+            /// Window sums and squared sums from the integral images, with the tolerances of cv::matchTemplate
+            for(int k = 0; k < count; k++){
+                int p = start + k;
+                double s = s1[p + w] - s1[p] - s0[p + w] + s0[p];
+                double q = q1[p + w] - q1[p] - q0[p + w] + q0[p];
+                double num = correlations[k] - s*templ_mean;
+                double t = std::sqrt(std::max(q - s*s/n, 0.0))*templ_norm;
+                if(std::fabs(num) < t){
+                    num /= t;
+                }
+                else if(std::fabs(num) < t*1.125){
+                    num = num > 0 ? 1 : -1;
+                }
+                else{
+                    num = 0;
+                }
+                scores[p] = (float)num;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file InspectorWidgetNccKernel.h
+ * @brief Vectorized normalized cross-correlation of 8-bit grayscale templates
+ * @author Christian Frisson
+ */
+
+#ifndef InspectorWidgetNccKernel_H
+#define InspectorWidgetNccKernel_H
+
+#include "opencv2/core/core.hpp"
+
+/// Instruction sets of the kernel, picked at runtime from those supported by the CPU
+enum InspectorWidgetNccKernelLevel { NCC_KERNEL_SCALAR, NCC_KERNEL_SSE4, NCC_KERNEL_AVX2 };
+
+/// Largest template side handled by the kernel, larger templates are left to cv::matchTemplate
+const int ncc_kernel_max_size = 64;
+
+/// Best level supported by both the build and the CPU
+InspectorWidgetNccKernelLevel nccKernelLevel();
+const char* nccKernelName(InspectorWidgetNccKernelLevel level);
+
+/// TM_CCOEFF_NORMED of tpl over ref into res, as cv::matchTemplate computes it, for 8-bit gray images
+/// Window terms are read from integral sums and squared sums (CV_64F) of an image in which ref is at offset
+/// Returns false without writing res if the images are not supported
+bool matchTemplateNcc(const cv::Mat& ref, const cv::Mat& tpl, cv::Mat& res, const cv::Mat& sums, const cv::Mat& sqsums, cv::Point offset,
+                      InspectorWidgetNccKernelLevel level = nccKernelLevel());
+
+#endif
@@ -8,6 +8,17 @@
 
 #include "InspectorWidgetProcessor.h"
 
+#include <cctype>
+#include <cfloat>
+#include <cstring>
+#include <future>
+
+#ifdef HAVE_FFMPEG
+extern "C" {
+#include <libavformat/avformat.h>
+}
+#endif
+
 #include <uiohook.h>
 
 using namespace rapidjson;
@@ -480,6 +491,16 @@ InspectorWidgetProcessor::InspectorWidgetProcessor(){
     status_phase = "constructor";
     this->clear();
 
+    const char* run_statistic_keys[STAT_RUN_COUNT] = {
+        "seek/estimated time saved", "seek/keyframe seeks", "seek/backend seeks", "seek/missed seeks", "seek/seek time",
+        "seek/skips", "seek/decoded frames", "seek/decode time",
+        "frames/hits", "frames/misses",
+        "ocr/hits", "ocr/misses"
+    };
+    for(int _s = 0; _s < STAT_RUN_COUNT; _s++){
+        run_statistics[_s] = internStatistic(run_statistic_keys[_s]);
+    }
+
     parser_operators = 0;
     //Methods:
     //0: SQDIFF
@@ -493,6 +514,13 @@ InspectorWidgetProcessor::InspectorWidgetProcessor(){
     // TM COEFF NORMED no thres color/gray
     // TM CCORR NORMED thres gray
 
+    fastmatchlevels = 2;
+    analysislevels = 0;
+
+    ocr_jobs_in_flight = 0;
+    ocr_jobs_max_in_flight = 1;
+    ocr_jobs_stop = false;
+
     max_Trackbar = 5;
 
     with_gui = false;
@@ -544,6 +572,8 @@ InspectorWidgetProcessor::InspectorWidgetProcessor(){
     supported_input_hook_actions.push_back("getModifierKeysPressed");
     //supported_input_hook_actions.push_back("matchKey");
     //supported_input_hook_actions.push_back("getInputInactivity"); // with user-definable temporal threshold
+
+    supported_setting_actions.push_back("set");
 }
 
 void InspectorWidgetProcessor::clear(){
@@ -571,6 +601,9 @@ void InspectorWidgetProcessor::clear(){
     
     templates.clear();
     gray_templates.clear();
+    gray_template_pyramids.clear();
+    glyph_templates.clear();
+    clearFrameCache();
     template_x.clear();
     template_y.clear();
     template_val.clear();
@@ -658,13 +691,33 @@ void InspectorWidgetProcessor::clear(){
     ax_hover_closest_parsed = false;*/
 
     annotation_progress.clear();
+    settings.clear();
+    annotation_settings.clear();
+    internSettings();
+    annotation_table = InspectorWidgetAnnotationTable();
+}
+
+void InspectorWidgetProcessor::internSettings(){
+    ocr_batch = getSetting("ocrBatch",0) > 0;
+    ocr_batch_size = std::max(1,(int)getSetting("ocrBatchSize",8));
+    ocr_cache_size = (int)getSetting("ocrCacheSize",1024);
+    seek_latency = getSetting("seekCost",-1);
+    adaptive_seek = getSetting("adaptiveSeek",1) > 0;
+    frame_cache_size = std::max(1,(int)getSetting("frameCacheSize",8));
 }
 
 InspectorWidgetProcessor::~InspectorWidgetProcessor(){
+    stopOcrWorkers();
     file.close();
     for(std::map<std::string,std::ofstream>::iterator _csvfile = csvfile.begin(); _csvfile!=csvfile.end();_csvfile++){
         _csvfile->second.close();
     }
+    for(std::map<std::string,std::vector<tesseract::TessBaseAPI*> >::iterator _engines = ocr_engines.begin(); _engines!=ocr_engines.end();_engines++){
+        for(std::vector<tesseract::TessBaseAPI*>::iterator _engine = _engines->second.begin(); _engine != _engines->second.end(); _engine++){
+            (*_engine)->End();
+            delete *_engine;
+        }
+    }
 }
 
 //std::map<std::string, std::vector<float> > InspectorWidgetProcessor::parseCSV(std::string file){
@@ -800,134 +853,365 @@ void fastMatchTemplate(cv::Mat& srca,  // The reference image
                        int maxlevel,   // Number of levels
                        int match_method)
 {
-    std::vector<cv::Mat> refs, tpls, results;
+    std::vector<cv::Mat> refs, tpls;
 
     // Build Gaussian pyramid
     cv::buildPyramid(srca, refs, maxlevel);
     cv::buildPyramid(srcb, tpls, maxlevel);
 
+    fastMatchTemplate(refs, tpls, dst, maxlevel, match_method, 5, fastMatchPruningThreshold(match_method));
+}
+
+double fastMatchPruningThreshold(int match_method)
+{
+    // Coarse scores of true matches are lowered by the pyramid blur,
+    // so these thresholds are looser than the detection threshold
+    switch(match_method){
+    case TM_SQDIFF_NORMED:
+        return 0.5;
+    case TM_CCORR_NORMED:
+        return 0.8;
+    case TM_CCOEFF_NORMED:
+        return 0.3;
+    case TM_SQDIFF:
+        return FLT_MAX;
+    default:
+        return -FLT_MAX;
+    }
+}
+
+void fastMatchCandidates(const cv::Mat& res,  // Template matching result
+                         cv::Size suppression, // Neighborhood suppressed around each peak
+                         int match_method,
+                         int candidates,       // Maximum number of peaks
+                         double threshold,     // Pruning threshold
+                         std::vector<cv::Point>& peaks,
+                         cv::Mat scores)       // Buffer of the size and type of res, allocated if empty
+{
+    bool lower = ( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED );
+    float worst = lower ? FLT_MAX : -FLT_MAX;
+    res.copyTo(scores);
+    peaks.clear();
+
+    while((int)peaks.size() < candidates)
+    {
+        double minVal; double maxVal; Point minLoc; Point maxLoc;
+        minMaxLoc( scores, &minVal, &maxVal, &minLoc, &maxLoc, Mat() );
+        double val = lower ? minVal : maxVal;
+        cv::Point loc = lower ? minLoc : maxLoc;
+
+        // The best peak is always kept, others only if they pass the threshold
+        if(val == worst || (!peaks.empty() && (lower ? val > threshold : val < threshold))){
+            break;
+        }
+        peaks.push_back(loc);
+
+        cv::Rect neighborhood(loc.x - suppression.width/2, loc.y - suppression.height/2, suppression.width + 1, suppression.height + 1);
+        scores(neighborhood & cv::Rect(0, 0, scores.cols, scores.rows)).setTo(cv::Scalar(worst));
+    }
+}
+
+void fastMatchTemplate(const std::vector<cv::Mat>& refs,  // Gaussian pyramid of the reference image
+                       const std::vector<cv::Mat>& tpls,  // Gaussian pyramid of the template image
+                       cv::Mat& dst,   // Template matching result
+                       int maxlevel,   // Number of levels
+                       int match_method,
+                       int candidates,
+                       double threshold,
+                       int margin)
+{
+    InspectorWidgetMatchWorkspace workspace;
+    cv::Mat res;
+    fastMatchTemplate(refs, tpls, res, maxlevel, match_method, candidates, threshold, workspace, margin);
+    res.copyTo(dst);
+}
+
+/// Matches with the NCC kernel where the workspace allows it, with cv::matchTemplate otherwise
+void matchWorkspaceTemplate(const cv::Mat& ref, const cv::Mat& tpl, cv::Mat& res, int match_method, InspectorWidgetMatchWorkspace& workspace, bool coarse)
+{
+    if(workspace.kernel && match_method == TM_CCOEFF_NORMED && tpl.cols <= ncc_kernel_max_size && tpl.rows <= ncc_kernel_max_size){
+        if(coarse){
+            // Coarsest levels are views into the frame level of the integral images
+            if(!workspace.coarse_sums.empty() && std::max(tpl.cols, tpl.rows) <= workspace.kernel_size){
+                cv::Size whole; cv::Point offset;
+                ref.locateROI(whole, offset);
+                if(matchTemplateNcc(ref, tpl, res, workspace.coarse_sums, workspace.coarse_sqsums, offset, workspace.kernel_level)){
+                    return;
+                }
+            }
+        }
+        else{
+            // Windows around peaks are small enough to get their own integral images
+            cv::Mat sums = workspace.buffer(workspace.window_sums, ref.size() + cv::Size(1,1), CV_64F);
+            cv::Mat sqsums = workspace.buffer(workspace.window_sqsums, ref.size() + cv::Size(1,1), CV_64F);
+            cv::integral(ref, sums, sqsums, CV_64F);
+            if(matchTemplateNcc(ref, tpl, res, sums, sqsums, cv::Point(0,0), workspace.kernel_level)){
+                return;
+            }
+        }
+    }
+    cv::matchTemplate(ref, tpl, res, match_method);
+}
+
+void fastMatchTemplate(const std::vector<cv::Mat>& refs,  // Gaussian pyramid of the reference image
+                       const std::vector<cv::Mat>& tpls,  // Gaussian pyramid of the template image
+                       cv::Mat& dst,   // Template matching result, a view into the workspace
+                       int maxlevel,   // Number of levels
+                       int match_method,
+                       int candidates,
+                       double threshold,
+                       InspectorWidgetMatchWorkspace& workspace,
+                       int margin,
+                       const std::vector<cv::Rect>* windows,
+                       bool coarse_matched)
+{
+    bool lower = ( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED );
+    float worst = lower ? FLT_MAX : -FLT_MAX;
+
+    if((int)workspace.results.size() <= maxlevel){
+        workspace.results.resize(maxlevel+1);
+    }
     cv::Mat ref, tpl, res;
+    std::vector<cv::Point>& peaks = workspace.peaks;
+    peaks.clear();
 
     // Process each level
     for (int level = maxlevel; level >= 0; level--)
     {
         ref = refs[level];
         tpl = tpls[level];
-        res = cv::Mat::zeros(ref.size() + cv::Size(1,1) - tpl.size(), CV_32FC1);
-
+        res = workspace.buffer(workspace.results[level], ref.size() + cv::Size(1,1) - tpl.size(), CV_32FC1);
 
-        if (level == maxlevel)
+        if (level == maxlevel && coarse_matched)
+        {
+            // The coarsest result was computed in the workspace by another engine
+        }
+        else if (level == maxlevel && windows)
+        {
+            // On the smallest level, only the windows left by the prefilter are matched
+            res.setTo(cv::Scalar(worst));
+            for (size_t i = 0; i < windows->size(); i++)
+            {
+                cv::Rect r = (*windows)[i];
+                cv::Mat window = res(r);
+                matchWorkspaceTemplate(ref(r + (tpl.size() - cv::Size(1,1))), tpl, window, match_method, workspace, true);
+            }
+        }
+        else if (level == maxlevel)
         {
             // On the smallest level, just perform regular template matching
-            cv::matchTemplate(ref, tpl, res, match_method  /*TM_CCORR_NORMED*/);
+            matchWorkspaceTemplate(ref, tpl, res, match_method  /*TM_CCORR_NORMED*/, workspace, true);
         }
         else
         {
-            // On the next layers, template matching is performed on pre-defined
-            // ROI areas.  We define the ROI using the template matching result
-            // from the previous layer.
+            // On the next layers, template matching is only performed in small
+            // windows around the candidate peaks of the previous layer,
+            // unsearched locations get the worst score of the method.
 
-            cv::Mat mask;
-            cv::pyrUp(results.back(), mask);
+            res.setTo(cv::Scalar(worst));
+            cv::Rect bounds(0, 0, res.cols, res.rows);
 
-            cv::Mat mask8u;
-            mask.convertTo(mask8u, CV_8U);
-
-            // Find matches from previous layer
-            std::vector<std::vector<cv::Point> > contours;
-            cv::findContours(mask8u, contours, RETR_EXTERNAL, CHAIN_APPROX_NONE);
-
-            // Use the contours to define region of interest and
-            // perform template matching on the areas
-            for (int i = 0; i < contours.size(); i++)
+            for (int i = 0; i < peaks.size(); i++)
             {
-                cv::Rect r = cv::boundingRect(contours[i]);
-                cv::Rect rr = r + (tpl.size() - cv::Size(1,1));
-                if(rr.x+rr.width<=ref.cols && rr.y+rr.height<=ref.rows){
-                    cv::matchTemplate(
-                                ref(r + (tpl.size() - cv::Size(1,1))),
-                                tpl,
-                                res(r),
-                                match_method  /*TM_CCORR_NORMED*/
-                                );
+                cv::Rect r = cv::Rect(2*peaks[i].x - margin, 2*peaks[i].y - margin, 2*margin + 1, 2*margin + 1) & bounds;
+                if(r.width <= 0 || r.height <= 0){
+                    continue;
                 }
+                // Windows are matched in place, their views have the size of the result
+                cv::Mat window = res(r);
+                matchWorkspaceTemplate(
+                            ref(r + (tpl.size() - cv::Size(1,1))),
+                            tpl,
+                            window,
+                            match_method,  /*TM_CCORR_NORMED*/
+                            workspace,
+                            false
+                            );
             }
         }
 
-        // Only keep good matches
-        //CF cv::threshold(res, res, 0.9f, 1.0f, THRESH_TOZERO); // not working...
-        results.push_back(res);
+        // Only keep good matches as candidates for the next layer
+        if (level > 0)
+        {
+            fastMatchCandidates(res, tpl.size(), match_method, candidates, threshold, peaks, workspace.buffer(workspace.scores, res.size(), CV_32FC1));
+        }
     }
 
-    res.copyTo(dst);
+    dst = res;
+}
+
+cv::Mat InspectorWidgetMatchWorkspace::buffer(cv::Mat& capacity, cv::Size size, int type){
+    if(capacity.empty() || capacity.type() != type || capacity.cols < size.width || capacity.rows < size.height){
+        capacity.create(std::max(capacity.rows, size.height), std::max(capacity.cols, size.width), type);
+        allocations++;
+    }
+    return capacity(cv::Rect(0, 0, size.width, size.height));
+}
+
+void InspectorWidgetMatchWorkspace::reserve(const std::vector<cv::Size>& level_sizes){
+    if(results.size() < level_sizes.size()){
+        results.resize(level_sizes.size());
+    }
+    for(size_t level = 0; level < level_sizes.size(); level++){
+        buffer(results[level], level_sizes[level], CV_32FC1);
+    }
+    /// Refinement, tracking and dirty windows are at most the size of the finest result, peaks are searched from the next level
+    if(!level_sizes.empty()){
+        buffer(window, level_sizes[0], CV_32FC1);
+    }
+    if(level_sizes.size() > 1){
+        buffer(scores, level_sizes[1], CV_32FC1);
+    }
+    peaks.reserve(64);
+    rects.reserve(64);
+}
+
+/// Bases of the rolling hashes of rows then columns, computed modulo 2^64
+const uint64 row_hash_base = 1099511628211ULL;
+const uint64 column_hash_base = 11400714819323198485ULL;
+
+uint64 hashPower(uint64 base, int exponent){
+    uint64 power = 1;
+    for(int i = 0; i < exponent; i++){
+        power *= base;
+    }
+    return power;
+}
+
+/// Hash of a whole gray image, equal to the 2D rolling hash of a frame window holding the same pixels
+uint64 rollingHash(const cv::Mat& image){
+    uint64 hash = 0;
+    for(int y = 0; y < image.rows; y++){
+        const uchar* row = image.ptr(y);
+        uint64 row_hash = 0;
+        for(int x = 0; x < image.cols; x++){
+            row_hash = row_hash*row_hash_base + row[x];
+        }
+        hash = hash*column_hash_base + row_hash;
+    }
+    return hash;
 }
 
 bool InspectorWidgetProcessor::extractTemplate(std::string name, float x, float y, float w, float h,std::string id, float time){
+    InspectorWidgetTemplateRequest request;
+    request.name = name;
+    request.x = x;
+    request.y = y;
+    request.w = w;
+    request.h = h;
+    request.time = time;
+    return extractTemplates(std::vector<InspectorWidgetTemplateRequest>(1,request),id);
+}
+
+bool InspectorWidgetProcessor::extractTemplates(const std::vector<InspectorWidgetTemplateRequest>& requests, std::string id){
     std::string _videopath = datapath + videostem + ".mp4";
-    cv::VideoCapture _cap;
-    _cap.open(_videopath); // open a video file
-    if(!_cap.isOpened())  // check if succeeded
+    /// Frames are read through the shared capture and its cache of decoded frames
+    int _video_w = 0, _video_h = 0, _video_frames = 0;
+    float _fps = 0;
+    if(!openFrameCapture(_videopath,_video_w,_video_h,_video_frames,_fps))
     {
         std::stringstream msg;
         msg << "File " << _videopath << " not found or could not be opened";
         return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
     }
-    int _video_w = (int)(_cap.get(CAP_PROP_FRAME_WIDTH));
-    int _video_h = (int)(_cap.get(CAP_PROP_FRAME_HEIGHT));
-    int _video_frames = (int)(_cap.get(CAP_PROP_FRAME_COUNT));
-    float _fps = _cap.get(CAP_PROP_FPS);
     if(_video_w == 0 || _video_h == 0 || _fps == 0 || _video_frames == 0){
-        _cap.release();
         std::stringstream msg;
         msg << "Null dimension(s) for video file " << _videopath << " (w=" << _video_w << " ,h=" << _video_h << " ,fps=" << _fps<< " ,frames=" << _video_frames <<"), aborting";
         return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
     }
 
-    int _x = int( _video_w * x );
-    int _y = ceil( _video_h * y );
-    int _w = int( _video_w * w );
-    int _h = floor( _video_h * h );
-    if(_w == 0 || _h == 0){
-        _cap.release();
-        std::stringstream msg;
-        msg << "Null dimension(s) for video file " << _videopath << " (x=" << _x << " ,y=" << _y << " ,w=" << _w << " ,h=" << _h <<"), aborting";
-        return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
-    }
-    cv::Rect _rect (_x,_y,_w,_h);
-
-
+    /// All requests are validated before any frame is decoded
+    std::vector<cv::Rect> _rects;
+    std::vector<std::pair<int,size_t> > _order;
+    for(size_t r = 0; r < requests.size(); r++){
+        const InspectorWidgetTemplateRequest& request = requests[r];
+        int _x = int( _video_w * request.x );
+        int _y = ceil( _video_h * request.y );
+        int _w = int( _video_w * request.w );
+        int _h = floor( _video_h * request.h );
+        if(_w == 0 || _h == 0){
+            std::stringstream msg;
+            msg << "Null dimension(s) for video file " << _videopath << " (x=" << _x << " ,y=" << _y << " ,w=" << _w << " ,h=" << _h <<"), aborting";
+            return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
+        }
+        _rects.push_back(cv::Rect(_x,_y,_w,_h));
 
-    int _frame_pos = (int)(time*_fps);
-    if(_frame_pos < 0 || _frame_pos > _video_frames ){
-        _cap.release();
-        std::stringstream msg;
-        msg << "Frame position incompatible with video file " << _videopath << " : asked=" << _frame_pos << " ,max=" << _video_frames <<"), aborting";
-        return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
+        int _frame_pos = (int)(request.time*_fps);
+        if(_frame_pos < 0 || _frame_pos > _video_frames ){
+            std::stringstream msg;
+            msg << "Frame position incompatible with video file " << _videopath << " : asked=" << _frame_pos << " ,max=" << _video_frames <<"), aborting";
+            return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
+        }
+        _order.push_back(std::make_pair(_frame_pos,r));
     }
 
-    _cap.set(CAP_PROP_POS_FRAMES,_frame_pos);
+    /// Sorting by frame turns the reads into a single forward pass over the video
+    std::stable_sort(_order.begin(),_order.end());
 
+    /// Images are encoded and written while the next frames are decoded
+    size_t _max_writes = std::max(1u,std::thread::hardware_concurrency());
+    std::deque<std::future<bool> > _writes;
+    bool _written = true;
     cv::Mat _frame;
-    bool _frame_read = _cap.read(_frame);
+    int _frame_pos = -1;
+    for(size_t o = 0; o < _order.size(); o++){
+        const InspectorWidgetTemplateRequest& request = requests[_order[o].second];
+        if(_order[o].first != _frame_pos){
+            _frame_pos = _order[o].first;
+            bool _frame_read = readCachedFrame(_videopath,_frame_pos,_frame);
+            if(!_frame_read){
+                for(size_t f = 0; f < _writes.size(); f++){
+                    _writes[f].wait();
+                }
+                std::stringstream msg;
+                msg << "Couldn't read the required frame for template "<< request.name << " in video file " << _videopath <<" , aborting";
+                return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
+            }
+        }
 
-    if(!_frame_read){
-        _cap.release();
+        /// Templates are copied so that writes do not depend on the lifetime of cached frames
+        cv::Mat _template = _frame(_rects[_order[o].second]).clone();
+        std::string imagefile = this->datapath + request.name + ".png";
+        if(_writes.size() >= _max_writes){
+            _written = _writes.front().get() && _written;
+            _writes.pop_front();
+        }
+        _writes.push_back(std::async(std::launch::async,[imagefile,_template](){
+            return cv::imwrite(imagefile.c_str(),_template);
+        }));
+    }
+    while(!_writes.empty()){
+        _written = _writes.front().get() && _written;
+        _writes.pop_front();
+    }
+
+    if(!_written){
         std::stringstream msg;
-        msg << "Couldn't read the required frame for template "<< name << " in video file " << _videopath <<" , aborting";
+        msg << "Couldn't save templates in " << this->datapath << " , aborting";
         return setStatusAndReturn(/*phase*/"extractTemplate",/*error*/msg.str(), /*success*/"");
     }
-
-    cv::Mat _template = _frame(_rect);
-
-    std::string imagefile = this->datapath + name + ".png";
-    cv::imwrite(imagefile.c_str(),_template);
-
     return true;
 }
 
-void InspectorWidgetProcessor::matchTemplates(){
+void InspectorWidgetProcessor::matchTemplates(InspectorWidgetFrameContext& ctx){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+
+    /// The gray frame of the previous analysis is kept to detect unchanged regions
+    std::swap(ctx.ref_gray, ctx.previous_gray);
+    if(ctx.img.channels() == 1){
+        ctx.img.copyTo(ctx.ref_gray);
+    }
+    else{
+        cv::cvtColor(ctx.img, ctx.ref_gray, COLOR_BGR2GRAY);
+    }
+    bool gating = table.gating;
+    if(gating){
+        updateChangedBlocks(ctx);
+    }
+    ctx.analyses++;
 
-    cv::cvtColor(img, ref_gray, COLOR_BGR2GRAY);
+    /// The gray frame pyramid is built once and shared by all templates matched in this frame
+    cv::buildPyramid(ctx.ref_gray, ctx.ref_pyramid, fastmatchlevels + analysislevels);
 
     /*std::map<std::string,bool> _match_template;
     for(std::vector<std::string>::iterator _name = template_list.begin(); _name != template_list.end(); _name++ ){
@@ -955,37 +1239,39 @@ void InspectorWidgetProcessor::matchTemplates(){
         _match_template[*_t] = true;
     }*/
 
-    //for(std::list<std::string>::iterator _t = _templates.begin(); _t != _templates.end();_t++){
-    for(std::vector<std::string>::iterator _n = template_list.begin(); _n != template_list.end(); _n++ ){
+    InspectorWidgetFrameResult& result = ctx.result;
 
-        std::string _name = *_n;
+    /// Names, settings and dependencies were resolved to indices by internAnnotations
+    int64 loop_start = table.benchmark_overhead ? getTickCount() : 0;
+    int64 matching_ticks = 0;
+
+    //for(std::list<std::string>::iterator _t = _templates.begin(); _t != _templates.end();_t++){
+    for(size_t _index = 0; _index < table.template_annotation.size(); _index++ ){
 
-        bool _match_template = (inrect_map.find(_name)!=inrect_map.end());
+        bool _match_template = table.template_inrect[_index];
 
-        std::vector<std::string> logged_deps = template_matching_logged_dep_map[_name];
+        std::vector<int>& logged_deps = table.template_logged_deps[_index];
         bool logged_match = true;
-        for(std::vector<std::string>::iterator _d = logged_deps.begin(); _d != logged_deps.end(); _d++){
-            if(log_val[*_d][csv_frame]<_threshold){
+        for(std::vector<int>::iterator _d = logged_deps.begin(); _d != logged_deps.end(); _d++){
+            if((*table.logged_val[*_d])[ctx.csv_frame]<_threshold){
                 logged_match &= false;
             }
         }
         if(logged_deps.size()>0) _match_template = logged_match;
 
-        std::vector<std::string> new_deps = template_matching_new_dep_map[_name];
+        std::vector<int>& new_deps = table.template_new_deps[_index];
         bool new_match = true;
-        for(std::vector<std::string>::iterator _d = new_deps.begin(); _d != new_deps.end(); _d++){
-            if(template_val[*_d]<_threshold){
+        for(std::vector<int>::iterator _d = new_deps.begin(); _d != new_deps.end(); _d++){
+            if(*_d < 0 || ctx.template_val[*_d]<_threshold){
                 new_match &= false;
             }
         }
         if(new_deps.size()>0) _match_template = new_match;
 
-        if(template_matching_test[_name].empty()) _match_template = true;
-
-        bool skip = !requiresProcessing(_name);
+        if(table.template_always[_index]) _match_template = true;
 
-        //if( std::find(template_matching_new_dep_list.begin(),template_matching_new_dep_list.end(),_name) != template_matching_new_dep_list.end() ) _match_template = true;
-        //if( std::find(text_detect_new_dep_list.begin(),text_detect_new_dep_list.end(),_name) != text_detect_new_dep_list.end() ) _match_template = true;
+        int annotation = table.template_annotation[_index];
+        bool skip = !requiresProcessing(annotation,ctx);
 
         //if(_match_template[_name] == true){
         if(!skip){
@@ -994,145 +1280,315 @@ void InspectorWidgetProcessor::matchTemplates(){
                 cv::Mat _frame;
                 cv::Mat _template;
                 bool gray = true;
+                int test = table.template_test[_index];
 
-                if( template_matching_test[_name] == "inrect"){
-                    std::vector<int> _rect = this->inrect_map[_name];
-                    rect.x = _rect[0];
-                    rect.y = _rect[1];
-                    rect.width = _rect[2];
-                    rect.height = _rect[3];
+                if( test == REGION_INRECT){
+                    rect = table.template_rect[_index];
                 }
-                else if(template_matching_test[_name] == "below" || template_matching_test[_name] == "rightof"){
+                else if(test == REGION_BELOW || test == REGION_RIGHTOF){
 
-                    std::vector<std::string> deps = template_matching_dep_map[_name];
-                    if(deps.size()!=1){
-                        std::cerr << "Template to match '" << _name << "' should have only one dependency for test 'below', not extracting..." << std::endl;
+                    int anchor = table.template_anchor[_index];
+                    int source = table.template_anchor_source[_index];
+                    if(source == ANCHOR_NOT_SINGLE){
+                        std::cerr << "Template to match '" << template_list[_index] << "' should have only one dependency for test 'below', not extracting..." << std::endl;
                         return; //exit(0);
                         //break;
                     }
-                    std::string _depname = deps[0];
+                    if(source == ANCHOR_MISSING){
+                        std::cerr << "Test variable " << template_matching_dep_map.find(template_list[_index])->second[0] << " is neither part of logged templates nor templates to be extracted, aborting" << std::endl;
+                        return; //exit(0);
+                    }
 
-                    std::map<std::string, std::vector<float> >::iterator is_logged = log_val.find(_depname);
-                    std::vector<std::string>::iterator is_template = std::find(template_list.begin(),template_list.end(),_depname);
+                    float anchor_x, anchor_y;
+                    int anchor_w, anchor_h;
+                    if(source == ANCHOR_LOGGED){
+                        anchor_x = (*table.logged_x[anchor])[ctx.csv_frame];
+                        anchor_y = (*table.logged_y[anchor])[ctx.csv_frame];
+                        anchor_w = table.logged_w[anchor];
+                        anchor_h = table.logged_h[anchor];
+                    }
+                    else{
+                        anchor_x = ctx.template_x[anchor];
+                        anchor_y = ctx.template_y[anchor];
+                        anchor_w = table.template_w[anchor];
+                        anchor_h = table.template_h[anchor];
+                    }
 
-                    if(template_matching_test[_name] == "below"){
-                        if(is_logged!=log_val.end()){
-                            rect.x = log_x[_depname][csv_frame];
-                            rect.y = log_y[_depname][csv_frame]+logged_template_h[_depname];
-                            rect.width = logged_template_w[_depname];
-                            rect.height = img.rows - log_y[_depname][csv_frame] - logged_template_h[_depname];
-                        }
-                        else if(is_template!=template_list.end()){
-                            rect.x = template_x[_depname];
-                            rect.y = template_y[_depname]+template_h[_depname];
-                            rect.width = template_w[_depname];
-                            rect.height = img.rows - template_y[_depname] - template_h[_depname];
-                        }
-                        else{
-                            std::cerr << "Test variable " << _depname << " is neither part of logged templates nor templates to be extracted, aborting" << std::endl;
-                            return; //exit(0);
-                        }
+                    if(test == REGION_BELOW){
+                        rect.x = anchor_x;
+                        rect.y = anchor_y+anchor_h;
+                        rect.width = anchor_w;
+                        rect.height = ctx.img.rows - anchor_y - anchor_h;
                     }
-                    else if(template_matching_test[_name] == "rightof"){
-                        if(is_logged!=log_val.end()){
-                            rect.x = log_x[_depname][csv_frame]+logged_template_w[_depname];
-                            rect.y = log_y[_depname][csv_frame];
-                            rect.width = img.cols - log_x[_depname][csv_frame] - logged_template_w[_depname];
-                            rect.height = logged_template_h[_depname];
-                        }
-                        else if(is_template!=template_list.end()){
-                            rect.x = template_x[_depname]+template_w[_depname];
-                            rect.y = template_y[_depname];
-                            rect.width = img.cols - template_x[_depname] - template_w[_depname];
-                            rect.height = template_h[_depname];
-                        }
-                        else{
-                            std::cerr << "Test variable " << _depname << " is neither part of logged templates nor templates to be extracted, aborting" << std::endl;
-                            return; //exit(0);
-                        }
+                    else{
+                        rect.x = anchor_x+anchor_w;
+                        rect.y = anchor_y;
+                        rect.width = ctx.img.cols - anchor_x - anchor_w;
+                        rect.height = anchor_h;
                     }
                 }
 
-                if( template_matching_test[_name] == "inrect" || template_matching_test[_name] == "below" || template_matching_test[_name] == "rightof"){
+                bool roi = ( test == REGION_INRECT || test == REGION_BELOW || test == REGION_RIGHTOF);
+                if(roi){
                     if(gray){
-                        _frame = ref_gray(rect);
+                        _frame = ctx.ref_gray(rect);
                     }
                     else{
-                        _frame = img(rect);
+                        _frame = ctx.img(rect);
                     }
-                    std::string imagefile = this->datapath + this->videostem + "-" + _name + ".png";
-                    cv::imwrite(imagefile.c_str(),_frame);
+                    result.debug_images[_index] = _frame.clone();
                 }
                 else{
                     if(gray){
-                        _frame = ref_gray;
+                        _frame = ctx.ref_gray;
                     }
                     else{
-                        _frame = img;
+                        _frame = ctx.img;
                     }
                 }
 
                 if(gray){
-                    _template = gray_templates[_name];
+                    _template = table.gray_templates[_index];
                 }
                 else{
-                    _template = templates[_name];
+                    _template = templates[template_list[_index]];
                 }
 
-                int fastmatchlevels = 2;
+                int levels = fastmatchlevels;
                 if( _frame.cols - _template.cols <= 1 || _frame.rows - _template.rows <= 1 ){ // pyramid removes 1 px per dim
-                    fastmatchlevels = 0;
+                    levels = 0;
                 }
 
-                //MatchingMethod( _frame, _template, dst, match_method);
-                fastMatchTemplate(_frame, _template, dst, fastmatchlevels, match_method);
-
                 /// Localizing the best match with minMaxLoc
                 double minVal; double maxVal; Point minLoc; Point maxLoc;
                 double matchVal; Point matchLoc;
 
-                minMaxLoc( dst, &minVal, &maxVal, &minLoc, &maxLoc, Mat() );
+                int64 matching_start = table.benchmark_overhead ? getTickCount() : 0;
+                std::vector<double*>& counters = table.template_statistics[_index];
+
+                /// The previous match is carried forward if its region and the pyramid border around it did not change
+                InspectorWidgetMatchRecord& record = ctx.match_records[_index];
+                cv::Rect region = (rect.width > 0 && rect.height > 0) ? rect : cv::Rect(0, 0, ctx.ref_gray.cols, ctx.ref_gray.rows);
+                int border = 4 << fastmatchlevels;
+                bool unchanged = gating && gray && record.analysis == ctx.analyses-1 && record.rect == rect
+                        && regionUnchanged(ctx, cv::Rect(region.x - border, region.y - border, region.width + 2*border, region.height + 2*border));
+
+                if(unchanged){
+                    minVal = record.minVal;
+                    maxVal = record.maxVal;
+                    matchLoc = record.loc;
+                    matchVal = record.val;
+                    addStatistic(counters[STAT_GATING_SKIPPED], 1);
+                }
+                else if(gating && gray && ctx.changes_valid && table.dirty_matching[_index] && record.analysis == ctx.analyses-1 && record.rect == rect
+                        && matchDirtyRegions(ctx, _index, region, _template, record, minVal, maxVal, matchLoc, matchVal)){
+                    record.minVal = minVal;
+                    record.maxVal = maxVal;
+                    record.loc = matchLoc;
+                    record.val = matchVal;
+                }
+                else if(gray && table.tracking[_index]
+                        && matchTrackingWindow(ctx, _index, region, _template, record, minVal, maxVal, matchLoc, matchVal)){
+                    record.minVal = minVal;
+                    record.maxVal = maxVal;
+                    record.loc = matchLoc;
+                    record.val = matchVal;
+                }
+                else{
+                    int candidates = table.prune_candidates[_index];
+                    double pruning_threshold = table.prune_threshold[_index];
+                    int64 match_start = getTickCount();
+
+                    int scale_level = 0;
+                    bool rejected = false;
+                    bool exact = false;
+                    /// Offset of the region of interest from the origin of its pyramid views
+                    cv::Point origin(0,0);
+
+                    /// Exact occurrences are scored by the matching method on their window alone
+                    if(gray && table.exact_matching[_index]){
+                        exact = matchExact(ctx, _index, _frame, minLoc);
+                        if(exact){
+                            ctx.dst = ctx.workspace.buffer(ctx.workspace.window, cv::Size(1,1), CV_32FC1);
+                            cv::matchTemplate(_frame(cv::Rect(minLoc, _template.size())), _template, ctx.dst, match_method);
+                            maxLoc = minLoc;
+                            minVal = maxVal = ctx.dst.at<float>(0,0);
+                            addStatistic(counters[STAT_EXACT_HITS], 1);
+                        }
+                        else{
+                            addStatistic(counters[STAT_EXACT_FALLBACKS], 1);
+                        }
+                    }
+
+                    //MatchingMethod( _frame, _template, dst, match_method);
+                    if(gray && !exact){
+                        /// Regions of interest are views into the levels of the shared frame pyramid
+                        std::vector<cv::Mat>& tpls = table.gray_template_pyramids[_index];
+
+                        /// Reduced resolution analysis starts matching from a coarser level of both pyramids
+                        scale_level = std::min(table.analysis_level[_index], analysislevels);
+                        while(scale_level > 0 && (tpls[scale_level].cols < 8 || tpls[scale_level].rows < 8)){
+                            scale_level--;
+                        }
+                        /// Views start on multiples of the coarsest scale so that peaks upscale to the same pixels at each level
+                        std::vector<cv::Mat>& refs = ctx.refs;
+                        cv::Rect aligned = rect;
+                        if(roi){
+                            int mask = (1 << (scale_level + levels)) - 1;
+                            origin = cv::Point(rect.x & mask, rect.y & mask);
+                            aligned = cv::Rect(rect.x - origin.x, rect.y - origin.y, rect.width + origin.x, rect.height + origin.y);
+                            refs.assign(1,ctx.ref_gray(aligned));
+                        }
+                        else{
+                            refs.assign(1,_frame);
+                        }
+                        for(int level = 1; level <= scale_level + levels; level++){
+                            cv::Mat ref = ctx.ref_pyramid[level];
+                            if(roi){
+                                cv::Rect r(aligned.x >> level, aligned.y >> level, aligned.width >> level, aligned.height >> level);
+                                ref = ref(r & cv::Rect(0, 0, ref.cols, ref.rows));
+                            }
+                            if( ref.cols - tpls[level].cols < 0 || ref.rows - tpls[level].rows < 0 ){
+                                break;
+                            }
+                            refs.push_back(ref);
+                        }
+                        scale_level = std::min(scale_level, (int)refs.size()-1);
+                        refs.erase(refs.begin(), refs.begin() + scale_level);
+                        ctx.tpls.assign(tpls.begin() + scale_level, tpls.end());
+                        levels = refs.size()-1;
+
+                        /// Full frame searches may correlate the coarsest level with the cached template spectrum
+                        bool coarse_matched = false;
+                        if(table.fft_matching[_index] && !roi && levels + scale_level == table.fft_level[_index]
+                                && refs[levels].size() == table.fft_frame_sizes[table.fft_level[_index]]){
+                            if((int)ctx.workspace.results.size() <= levels){
+                                ctx.workspace.results.resize(levels+1);
+                            }
+                            cv::Mat coarse = ctx.workspace.buffer(ctx.workspace.results[levels], refs[levels].size() + cv::Size(1,1) - ctx.tpls[levels].size(), CV_32FC1);
+                            matchSpectrum(ctx, _index, coarse);
+                            coarse_matched = true;
+                            addStatistic(counters[STAT_FFT_MATCHES], 1);
+                        }
+
+                        /// The prefilter leaves the coarsest windows whose statistics can reach those of the template
+                        std::vector<cv::Rect>* windows = 0;
+                        if(!coarse_matched && table.prefilter[_index] && match_method == TM_CCOEFF_NORMED && table.template_stddevs[_index][scale_level + levels] > 0){
+                            windows = &ctx.prefilter_windows;
+                            prefilterWindows(ctx, _index, refs[levels], scale_level + levels, *windows);
+                            rejected = windows->empty();
+                        }
+                        /// The NCC kernel reads the windows of the coarsest level from the integral images of the frame level
+                        int top = scale_level + levels;
+                        ctx.workspace.coarse_sums = cv::Mat();
+                        ctx.workspace.coarse_sqsums = cv::Mat();
+                        if(table.ncc_kernel && match_method == TM_CCOEFF_NORMED && !coarse_matched && !rejected
+                                && std::max(ctx.tpls[levels].cols, ctx.tpls[levels].rows) <= table.ncc_kernel_size){
+                            updateIntegrals(ctx, top);
+                            ctx.workspace.coarse_sums = ctx.ref_sums[top];
+                            ctx.workspace.coarse_sqsums = ctx.ref_sqsums[top];
+                        }
+                        if(!rejected){
+                            fastMatchTemplate(refs, ctx.tpls, ctx.dst, levels, match_method, candidates, pruning_threshold, ctx.workspace, 2, windows, coarse_matched);
+                            if(table.benchmark_kernel && match_method == TM_CCOEFF_NORMED){
+                                benchmarkNccKernel(template_list[_index], refs[levels], ctx.tpls[levels]);
+                            }
+                        }
+                    }
+                    else if(!gray){
+                        fastMatchTemplate(_frame, _template, ctx.dst, levels, match_method);
+                    }
 
-                /// For SQDIFF and SQDIFF_NORMED, the best matches are lower values. For all the other methods, the higher the better
-                if( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED )
-                { matchLoc = minLoc; matchVal = minVal; }
-                else
-                { matchLoc = maxLoc; matchVal = maxVal; }
+                    if(rejected){
+                        /// Every window of the frame is flat, where TM_CCOEFF_NORMED scores 0
+                        minVal = maxVal = 0;
+                        minLoc = maxLoc = Point(0,0);
+                        addStatistic(counters[STAT_PREFILTER_SKIPPED], 1);
+                    }
+                    else if(!exact){
+                        minMaxLoc( ctx.dst, &minVal, &maxVal, &minLoc, &maxLoc, Mat() );
+                    }
 
-                std::cout << "Match location for '"<< _name << "': x=" <<  matchLoc.x << " y=" <<  matchLoc.y  << " with minVal=" << minVal << " maxVal=" << maxVal <<" matchVal=" << matchVal <<std::endl;
+                    /// For SQDIFF and SQDIFF_NORMED, the best matches are lower values. For all the other methods, the higher the better
+                    if( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED )
+                    { matchLoc = minLoc; matchVal = minVal; }
+                    else
+                    { matchLoc = maxLoc; matchVal = maxVal; }
 
-                if(template_matching_test[_name] == "below" || template_matching_test[_name] == "rightof"){
+                    if(!rejected){
+                        matchLoc = cv::Point((matchLoc.x << scale_level) - origin.x, (matchLoc.y << scale_level) - origin.y);
+                    }
+                    if(scale_level > 0 && !rejected){
+                        addStatistic(counters[STAT_SCALE_COARSE], 1);
+
+                        /// Coarse scores are never final: scores close to the threshold are refined by a full resolution search around the coarse peak,
+                        /// others are scored at full resolution at the peak alone
+                        bool refine = std::fabs(matchVal - _threshold) <= table.analysis_margin[_index];
+                        int pad = refine ? 2 << scale_level : 0;
+                        matchLoc.x = std::max(0, std::min(matchLoc.x, _frame.cols - _template.cols));
+                        matchLoc.y = std::max(0, std::min(matchLoc.y, _frame.rows - _template.rows));
+                        cv::Rect window = cv::Rect(matchLoc.x - pad, matchLoc.y - pad, _template.cols + 2*pad, _template.rows + 2*pad) & cv::Rect(0, 0, _frame.cols, _frame.rows);
+                        if(window.width >= _template.cols && window.height >= _template.rows){
+                            ctx.dst = ctx.workspace.buffer(ctx.workspace.window, window.size() + cv::Size(1,1) - _template.size(), CV_32FC1);
+                            cv::matchTemplate(_frame(window), _template, ctx.dst, match_method);
+                            minMaxLoc( ctx.dst, &minVal, &maxVal, &minLoc, &maxLoc, Mat() );
+                            if( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED )
+                            { matchLoc = minLoc; matchVal = minVal; }
+                            else
+                            { matchLoc = maxLoc; matchVal = maxVal; }
+                            matchLoc = cv::Point(window.x + matchLoc.x, window.y + matchLoc.y);
+                            if(refine){
+                                addStatistic(counters[STAT_SCALE_REFINED], 1);
+                            }
+                        }
+                    }
 
-                    template_x[_name] = rect.x + matchLoc.x;
-                    template_y[_name] = rect.y + matchLoc.y;
-                    template_val[_name] = matchVal;
+                    if(table.benchmark_matching){
+                        benchmarkMatchTemplate(template_list[_index], _frame, _template, matchLoc, (double)(getTickCount()-match_start)/getTickFrequency());
+                    }
 
+                    record.minVal = minVal;
+                    record.maxVal = maxVal;
+                    record.loc = matchLoc;
+                    record.val = matchVal;
+                    if(gating){
+                        addStatistic(counters[STAT_GATING_MATCHED], 1);
+                    }
                 }
-                else{
+                record.analysis = ctx.analyses;
+                record.rect = rect;
+                if(table.benchmark_overhead){
+                    matching_ticks += getTickCount() - matching_start;
+                }
+
+                if(test == REGION_BELOW || test == REGION_RIGHTOF){
 
-                    template_x[_name] = matchLoc.x;
-                    template_y[_name] = matchLoc.y;
-                    template_val[_name] = matchVal;
+                    ctx.template_x[_index] = rect.x + matchLoc.x;
+                    ctx.template_y[_index] = rect.y + matchLoc.y;
+                    ctx.template_val[_index] = matchVal;
 
                 }
+                else{
+
+                    ctx.template_x[_index] = matchLoc.x;
+                    ctx.template_y[_index] = matchLoc.y;
+                    ctx.template_val[_index] = matchVal;
 
-                if(template_vals[_name].size() == 0){
-                    std::cout << "Init storage of values from template " << _name << std::endl;
-                    template_vals[_name].resize(this->video_frames,0.0);
                 }
 
-                template_vals[_name][frame] = matchVal;
+                /// Values are stored in template_vals when the frame result is committed
+                result.template_matched[_index] = true;
 
                 //CF
 
                 if(with_gui && matchVal>_threshold){
                     cv::rectangle(
-                                img, matchLoc,
-                                cv::Point(matchLoc.x + templates[_name].cols, matchLoc.y + templates[_name].rows),
+                                ctx.img, matchLoc,
+                                cv::Point(matchLoc.x + _template.cols, matchLoc.y + _template.rows),
                                 cv::Scalar(0,255,0), 2
                                 );
                     cv::floodFill(
-                                img, matchLoc,
+                                ctx.img, matchLoc,
                                 cv::Scalar(0), 0,
                                 cv::Scalar(.1),
                                 cv::Scalar(1.)
@@ -1140,29 +1596,36 @@ void InspectorWidgetProcessor::matchTemplates(){
                 }
             }
             else{
-                template_x[_name] = 0;
-                template_y[_name] = 0;
-                template_val[_name] = 0;
+                ctx.template_x[_index] = 0;
+                ctx.template_y[_index] = 0;
+                ctx.template_val[_index] = 0;
 
             }
-            file << "," << template_x[_name];
-            file << "," << template_y[_name];
-            file << "," << template_val[_name];
+            result.template_processed[_index] = true;
+            result.template_x[_index] = ctx.template_x[_index];
+            result.template_y[_index] = ctx.template_y[_index];
+            result.template_val[_index] = ctx.template_val[_index];
 
-            csvfile[_name] << frame;
-            csvfile[_name] << "," << template_x[_name];
-            csvfile[_name] << "," << template_y[_name];
-            csvfile[_name] << "," << template_val[_name];
-            csvfile[_name] << std::endl;
-
-            annotation_progress[_name] = (float)frame/(float)this->video_frames;
+            ctx.annotation_progress[annotation] = (float)ctx.frame/(float)this->video_frames;
         }
 
     }
-}
 
+    /// Workspaces are reserved with the frame context, buffers grown afterwards are counted once per frame
+    InspectorWidgetMatchWorkspace& workspace = ctx.workspace;
+    if(workspace.allocations != workspace.reported_allocations){
+        addStatistic(table.workspace_allocations, workspace.allocations - workspace.reported_allocations);
+        workspace.reported_allocations = workspace.allocations;
+    }
+
+    if(table.benchmark_overhead){
+        addStatistic(table.overhead_frames, 1);
+        addStatistic(table.overhead_time, (double)(getTickCount() - loop_start - matching_ticks)/getTickFrequency());
+        addStatistic(table.overhead_image_time, (double)matching_ticks/getTickFrequency());
+    }
+}
 
-bool InspectorWidgetProcessor::detectText(){
+bool InspectorWidgetProcessor::detectText(InspectorWidgetFrameContext& ctx){
 
     /*std::map<std::string,bool> _detect_text;
     for(std::set<std::string>::iterator _name = text_detect_list.begin(); _name != text_detect_list.end(); _name++ ){
@@ -1191,25 +1654,32 @@ bool InspectorWidgetProcessor::detectText(){
     }
 */
 
-    for(std::set<std::string>::iterator _n= text_detect_list.begin(); _n != text_detect_list.end(); _n++ ){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    InspectorWidgetFrameResult& result = ctx.result;
+    std::vector<std::shared_ptr<InspectorWidgetOcrJob> > jobs;
 
-        std::string _name = *_n;
+    int64 loop_start = table.benchmark_overhead ? getTickCount() : 0;
+    int64 image_ticks = 0;
+
+    for(size_t _index = 0; _index < table.text_annotation.size(); _index++ ){
 
-        bool _detect_text = (inrect_map.find(_name)!=inrect_map.end());;
+        int annotation = table.text_annotation[_index];
 
-        std::vector<std::string> logged_deps = text_detect_logged_dep_map[_name];
+        bool _detect_text = table.text_inrect[_index];
+
+        std::vector<int>& logged_deps = table.text_logged_deps[_index];
         bool logged_match = true;
-        for(std::vector<std::string>::iterator _d = logged_deps.begin(); _d != logged_deps.end(); _d++){
-            if(log_val[*_d][csv_frame]<_threshold){
+        for(std::vector<int>::iterator _d = logged_deps.begin(); _d != logged_deps.end(); _d++){
+            if((*table.logged_val[*_d])[ctx.csv_frame]<_threshold){
                 logged_match &= false;
             }
         }
         if(logged_deps.size()>0) _detect_text = logged_match;
 
-        std::vector<std::string> new_deps = text_detect_new_dep_map[_name];
+        std::vector<int>& new_deps = table.text_new_deps[_index];
         bool new_match = true;
-        for(std::vector<std::string>::iterator _d = new_deps.begin(); _d != new_deps.end(); _d++){
-            if(template_val[*_d]<_threshold){
+        for(std::vector<int>::iterator _d = new_deps.begin(); _d != new_deps.end(); _d++){
+            if(*_d < 0 || ctx.template_val[*_d]<_threshold){
                 new_match &= false;
             }
         }
@@ -1218,40 +1688,41 @@ bool InspectorWidgetProcessor::detectText(){
         std::string text(" ");
         float x(0.0),y(0.0);
 
-        bool skip = !requiresProcessing(_name);
+        bool skip = !requiresProcessing(annotation,ctx);
         if(!skip){
 
             //if(_detect_text[_name] == true){
             if(_detect_text == true){
 
                 cv::Rect rect;
+                int test = table.text_test[_index];
 
-                if( text_detect_test[_name] == "inrect"){
-                    std::vector<int> _rect = this->inrect_map[_name];
-                    rect.x = _rect[0];
-                    rect.y = _rect[1];
-                    rect.width = _rect[2];
-                    rect.height = _rect[3];
+                if( test == REGION_INRECT){
+                    rect = table.text_rect[_index];
                 }
-                else if (text_detect_test[_name] == "between"){
-
-                    std::vector<float> _xs,_ys;
-                    std::vector<int> _ws,_hs;
-
-                    for(std::vector<std::string>::iterator _l = text_detect_logged_dep_map[_name].begin(); _l != text_detect_logged_dep_map[_name].end(); _l++ ){
-                        _xs.push_back( log_x[*_l][csv_frame] );
-                        _ys.push_back( log_y[*_l][csv_frame] );
-                        _ws.push_back( logged_template_w[*_l] );
-                        _hs.push_back( logged_template_h[*_l] );
+                else if (test == REGION_BETWEEN){
+
+                    float _xs[2],_ys[2];
+                    int _ws[2],_hs[2];
+                    size_t _count = 0;
+
+                    for(std::vector<int>::iterator _l = logged_deps.begin(); _l != logged_deps.end(); _l++, _count++ ){
+                        if(_count >= 2) continue;
+                        _xs[_count] = (*table.logged_x[*_l])[ctx.csv_frame];
+                        _ys[_count] = (*table.logged_y[*_l])[ctx.csv_frame];
+                        _ws[_count] = table.logged_w[*_l];
+                        _hs[_count] = table.logged_h[*_l];
                     }
-                    for(std::vector<std::string>::iterator _l = text_detect_new_dep_map[_name].begin(); _l != text_detect_new_dep_map[_name].end(); _l++ ){
-                        _xs.push_back( template_x[*_l] );
-                        _ys.push_back( template_y[*_l] );
-                        _ws.push_back( template_w[*_l] );
-                        _hs.push_back( template_h[*_l] );
+                    for(std::vector<int>::iterator _l = new_deps.begin(); _l != new_deps.end(); _l++, _count++ ){
+                        if(_count >= 2) continue;
+                        _xs[_count] = (*_l >= 0) ? ctx.template_x[*_l] : 0;
+                        _ys[_count] = (*_l >= 0) ? ctx.template_y[*_l] : 0;
+                        _ws[_count] = (*_l >= 0) ? table.template_w[*_l] : 0;
+                        _hs[_count] = (*_l >= 0) ? table.template_h[*_l] : 0;
                     }
-                    if(_xs.size()!=2 || _ys.size()!=2 ){
+                    if(_count!=2 ){
                         std::cerr << "Can only detect text between 2 matched templates" << std::endl;
+                        submitOcrJobs(jobs);
                         return false;
                     }
 
@@ -1307,182 +1778,2761 @@ bool InspectorWidgetProcessor::detectText(){
                     rect.width = _r-_l;
                     rect.height = _b-_t;
 
-                }
-                else{
-                    std::cerr << "Test " << text_detect_test[_name] << " not implemented for text detection, aborting" << std::endl;
-                    return 0; //exit(0);
-                }
+                }
+                else{
+                    std::cerr << "Test " << text_detect_test.find(table.annotation_names[annotation])->second << " not implemented for text detection, aborting" << std::endl;
+                    submitOcrJobs(jobs);
+                    return 0; //exit(0);
+                }
+
+                if(with_gui){
+                    cv::Mat imz  = ctx.img.clone();
+
+                    //            cv::rectangle(
+                    //                        imz, cv::Point(_xs[0] , _ys[0]),
+                    //                    cv::Point(_xs[0]+_ws[0] , _ys[0]+_hs[0]),
+                    //                    cv::Scalar(0,255,0), 2
+                    //                    );
+                    //            cv::floodFill(
+                    //                        imz, cv::Point(_xs[0] , _ys[0]),
+                    //                    cv::Scalar(0), 0,
+                    //                    cv::Scalar(.1),
+                    //                    cv::Scalar(1.)
+                    //                    );
+
+                    //            cv::rectangle(
+                    //                        imz, cv::Point(_xs[1] , _ys[1]),
+                    //                    cv::Point(_xs[1]+_ws[1] , _ys[1]+_hs[1]),
+                    //                    cv::Scalar(255,0,0), 2
+                    //                    );
+                    //            cv::floodFill(
+                    //                        imz, cv::Point(_xs[1] , _ys[1]),
+                    //                    cv::Scalar(0), 0,
+                    //                    cv::Scalar(.1),
+                    //                    cv::Scalar(1.)
+                    //                    );
+
+                    cv::rectangle(
+                                imz, rect,
+                                cv::Scalar(0,255,0), 2
+                                );
+                    cv::floodFill(
+                                imz, cv::Point(rect.x , rect.y),
+                                cv::Scalar(0), 0,
+                                cv::Scalar(.1),
+                                cv::Scalar(1.)
+                                );
+
+
+                    imshow("orig", imz );
+                    waitKey(0);
+                }
+
+                int64 image_start = table.benchmark_overhead ? getTickCount() : 0;
+                cv::Mat image = ctx.img(rect);
+                if(image.channels() == 1){
+                    image = image.clone();
+                }
+                else{
+                    cvtColor( image, image, COLOR_RGB2GRAY);
+                }
+
+
+                if(!image.empty()){
+                    //namedWindow( text_window, WINDOW_KEEPRATIO | WINDOW_NORMAL );
+                    if(with_gui){
+                        imshow(text_window, image );
+                        waitKey(0);
+                    }
+
+
+                    if( table.text_threshold[_index]){
+                        //CF threshold test
+                        /* 0: Binary
+                     1: Binary Inverted
+                     2: Threshold Truncated
+                     3: Threshold to Zero
+                     4: Threshold to Zero Inverted
+                   */
+
+                        int threshold_type = 0;
+                        double max_BINARY_value = 255;
+                        double threshold_value = 0.5*255;
+
+                        threshold( image, image, threshold_value, max_BINARY_value,threshold_type );
+                    }
+
+                    result.debug_images[table.template_annotation.size()] = image.clone();
+
+                    /*std::stringstream patchpath;
+                patchpath << datapath << videostem << "-patch-" << csv_frame << ".png";
+                cv::imwrite(patchpath.str(),image);*/
+
+                    /// Text is recognized by the OCR workers if any, and joined back when the frame is committed
+                    std::shared_ptr<InspectorWidgetOcrJob> job(new InspectorWidgetOcrJob());
+                    job->frame = ctx.frame;
+                    job->region = (int)_index;
+                    job->name = table.annotation_names[annotation];
+                    job->type = table.text_type[_index];
+                    job->image = image.clone();
+                    jobs.push_back(job);
+                    result.text_jobs[_index] = job;
+                    x = rect.x;
+                    y = rect.y;
+
+
+                }
+                if(table.benchmark_overhead){
+                    image_ticks += getTickCount() - image_start;
+                }
+            }
+
+            ctx.text_x[_index] = x;
+            ctx.text_y[_index] = y;
+
+            result.text_processed[_index] = true;
+            result.text_x[_index] = x;
+            result.text_y[_index] = y;
+            result.text_txt[_index] = text;
+
+            ctx.annotation_progress[annotation] = (float)ctx.frame/(float)this->video_frames;
+        }
+
+    }
+
+    if(table.benchmark_overhead){
+        addStatistic(table.overhead_time, (double)(getTickCount() - loop_start - image_ticks)/getTickFrequency());
+        addStatistic(table.overhead_image_time, (double)image_ticks/getTickFrequency());
+    }
+    submitOcrJobs(jobs);
+    return true;
+}
+
+
+std::string InspectorWidgetProcessor::recognizeTesseract(std::string type, const cv::Mat& image, int* confidence){
+    /* Use Tesseract to try to decipher our image */
+    tesseract::TessBaseAPI* tesseract_api = acquireOcrEngine(type);
+
+    tesseract_api->SetImage((uchar*) image.data, image.cols, image.rows, 1, image.step);
+
+    char* utf8_text = tesseract_api->GetUTF8Text();
+    std::string text = utf8_text ? string(utf8_text) : string();
+    delete[] utf8_text;
+
+    if(confidence){
+        *confidence = tesseract_api->MeanTextConf();
+    }
+
+    releaseOcrEngine(type,tesseract_api);
+    return text;
+}
+
+void segmentGlyphs(const cv::Mat& image, std::vector<cv::Mat>& glyphs, std::vector<int>& gaps, int& line_height)
+{
+    glyphs.clear();
+    gaps.clear();
+    line_height = 0;
+
+    // Foreground is the minority color of the binarized region
+    cv::Mat binary;
+    cv::threshold(image, binary, 127, 255, THRESH_BINARY);
+    if(2*cv::countNonZero(binary) > binary.rows*binary.cols){
+        cv::threshold(image, binary, 127, 255, THRESH_BINARY_INV);
+    }
+
+    std::vector<uchar> columns(binary.cols,0);
+    int top = binary.rows, bottom = -1;
+    for(int y = 0; y < binary.rows; y++){
+        const uchar* row = binary.ptr(y);
+        bool foreground = false;
+        for(int x = 0; x < binary.cols; x++){
+            if(row[x]){
+                columns[x] = 1;
+                foreground = true;
+            }
+        }
+        if(foreground){
+            top = std::min(top,y);
+            bottom = y;
+        }
+    }
+    if(bottom < top){
+        return;
+    }
+    line_height = bottom - top + 1;
+
+    // Glyphs are runs of foreground columns over the whole text line height,
+    // so that the vertical position of ':', '.' and '-' is kept
+    int previous_end = -1;
+    for(int x = 0; x < binary.cols; ){
+        if(!columns[x]){
+            x++;
+            continue;
+        }
+        int start = x;
+        while(x < binary.cols && columns[x]){
+            x++;
+        }
+        cv::Mat glyph;
+        cv::resize(binary(cv::Rect(start, top, x - start, line_height)), glyph, cv::Size(12,16), 0, 0, INTER_AREA);
+        glyphs.push_back(glyph);
+        gaps.push_back(previous_end < 0 ? 0 : start - previous_end);
+        previous_end = x;
+    }
+}
+
+bool InspectorWidgetProcessor::recognizeGlyphs(InspectorWidgetOcrJob& job, std::string& text){
+    int64 start = getTickCount();
+    std::vector<cv::Mat> segments;
+    std::vector<int> gaps;
+    int line_height;
+    segmentGlyphs(job.image, segments, gaps, line_height);
+
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    std::vector<double*>& counters = table.text_glyph_statistics[job.region];
+    std::shared_ptr<const std::map<char,cv::Mat> > learned;
+    {
+        std::unique_lock<std::mutex> lock(glyphs_mutex);
+        learned = glyph_templates[table.text_type_id[job.region]];
+    }
+    if(segments.empty() || learned->empty()){
+        addStatistic(counters[STAT_GLYPH_FALLBACKS], 1);
+        return false;
+    }
+
+    /// Segments and glyphs have the same normalized size, each glyph is scored at the single position by the NCC kernel
+    double threshold = table.text_glyph_threshold[job.region];
+    std::string recognized;
+    cv::Mat score(1, 1, CV_32FC1), sums, sqsums;
+    for(size_t g = 0; g < segments.size(); g++){
+        char best_char = 0;
+        double best_score = threshold;
+        cv::integral(segments[g], sums, sqsums, CV_64F);
+        for(std::map<char,cv::Mat>::const_iterator _glyph = learned->begin(); _glyph != learned->end(); _glyph++){
+            if(!matchTemplateNcc(segments[g], _glyph->second, score, sums, sqsums, cv::Point(0,0))){
+                cv::matchTemplate(segments[g], _glyph->second, score, TM_CCOEFF_NORMED);
+            }
+            double value = score.at<float>(0,0);
+            if(value >= best_score){
+                best_score = value;
+                best_char = _glyph->first;
+            }
+        }
+        if(!best_char){
+            addStatistic(counters[STAT_GLYPH_FALLBACKS], 1);
+            return false;
+        }
+        // Wide gaps separate words, as Tesseract would output them
+        if(gaps[g] > 0.6*line_height){
+            recognized += " ";
+        }
+        recognized += best_char;
+    }
+    text = recognized + "\n";
+    double time = (double)(getTickCount()-start)/getTickFrequency();
+    addStatistic(counters[STAT_GLYPH_RECOGNIZED], 1);
+    addStatistic(counters[STAT_GLYPH_TIME], time);
+
+    if(table.benchmark_glyphs){
+        /// Compare with the Tesseract-only path
+        start = getTickCount();
+        std::string reference = recognizeTesseract(job.type,job.image,0);
+        addStatistic(counters[STAT_GLYPH_TESSERACT_TIME], (double)(getTickCount()-start)/getTickFrequency());
+        reference.erase (std::remove_if(reference.begin(), reference.end(), [](unsigned char c){ return std::isspace(c) != 0; }), reference.end());
+        recognized.erase (std::remove(recognized.begin(), recognized.end(), ' '), recognized.end());
+        if(reference == recognized){
+            addStatistic(counters[STAT_GLYPH_AGREED], 1);
+        }
+    }
+    return true;
+}
+
+void InspectorWidgetProcessor::learnGlyphs(InspectorWidgetOcrJob& job, std::string text, int confidence){
+    /// Only confident reads with one character per segment are learned, first glyph of each character in frame order wins
+    if(confidence < annotation_table.text_glyph_confidence[job.region]){
+        return;
+    }
+    text.erase (std::remove_if(text.begin(), text.end(), [](unsigned char c){ return std::isspace(c) != 0; }), text.end());
+    std::vector<cv::Mat> segments;
+    std::vector<int> gaps;
+    int line_height;
+    segmentGlyphs(job.image, segments, gaps, line_height);
+    if(text.empty() || segments.size() != text.size()){
+        return;
+    }
+    std::unique_lock<std::mutex> lock(glyphs_mutex);
+    std::shared_ptr<const std::map<char,cv::Mat> >& learned = glyph_templates[annotation_table.text_type_id[job.region]];
+    std::shared_ptr<std::map<char,cv::Mat> > updated;
+    for(size_t g = 0; g < segments.size(); g++){
+        if(learned->find(text[g]) == learned->end() && (!updated || updated->find(text[g]) == updated->end())){
+            if(!updated){
+                updated.reset(new std::map<char,cv::Mat>(*learned));
+            }
+            (*updated)[text[g]] = segments[g].clone();
+        }
+    }
+    if(updated){
+        learned = updated;
+    }
+}
+
+bool InspectorWidgetProcessor::recognizeQuickly(InspectorWidgetOcrJob& job, std::string& text){
+    /// Text regions often stay identical over many frames
+    if(lookupOcrCache(job.type,job.image,text)){
+        return true;
+    }
+    /// Fixed-font digits are read with learned glyph templates when confident enough
+    /// Glyph reads are not cached, as the cache is shared with regions of the same type read by Tesseract alone
+    if(useGlyphs(job) && recognizeGlyphs(job,text)){
+        return true;
+    }
+    return false;
+}
+
+bool InspectorWidgetProcessor::useGlyphs(InspectorWidgetOcrJob& job){
+    return annotation_table.text_glyphs[job.region] != 0;
+}
+
+void InspectorWidgetProcessor::recognizeText(InspectorWidgetOcrJob& job){
+    std::string text;
+    if(!recognizeQuickly(job,text)){
+        int confidence = 0;
+        text = recognizeTesseract(job.type,job.image,useGlyphs(job) ? &confidence : 0);
+        if(useGlyphs(job)){
+            job.learn_text = text;
+            job.learn_confidence = confidence;
+        }
+        storeOcrCache(job.type,job.image,text);
+    }
+    finishText(job,text);
+}
+
+void InspectorWidgetProcessor::recognizeTextBatch(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >& jobs){
+    std::vector<InspectorWidgetOcrJob*> pending;
+    for(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = jobs.begin(); _j != jobs.end(); _j++){
+        std::string text;
+        if(recognizeQuickly(**_j,text)){
+            finishText(**_j,text);
+        }
+        else{
+            pending.push_back(_j->get());
+        }
+    }
+    if(pending.empty()){
+        return;
+    }
+    /// Regions the composite could not read are recognized alone, as missed by the cache and glyphs already
+    auto recognizeAlone = [&](InspectorWidgetOcrJob& job){
+        int confidence = 0;
+        std::string text = recognizeTesseract(job.type,job.image,useGlyphs(job) ? &confidence : 0);
+        if(useGlyphs(job)){
+            job.learn_text = text;
+            job.learn_confidence = confidence;
+        }
+        storeOcrCache(job.type,job.image,text);
+        finishText(job,text);
+    };
+    if(pending.size() == 1){
+        recognizeAlone(*pending[0]);
+        return;
+    }
+
+    /// Regions are stacked in one composite image, each in a band of its own background
+    std::string type = pending[0]->type;
+    int pad = 8;
+    int width = 0, height = pad;
+    for(size_t p = 0; p < pending.size(); p++){
+        width = std::max(width, pending[p]->image.cols);
+        height += pending[p]->image.rows + pad;
+    }
+    width += 2*pad;
+    cv::Mat composite(height, width, CV_8UC1, cv::Scalar(255));
+    std::vector<cv::Rect> bands;
+    int y = pad;
+    for(size_t p = 0; p < pending.size(); p++){
+        cv::Mat& image = pending[p]->image;
+        cv::Rect band(0, y - pad/2, width, image.rows + pad);
+        composite(band).setTo(cv::Scalar(image.at<uchar>(0,0)));
+        image.copyTo(composite(cv::Rect(pad, y, image.cols, image.rows)));
+        bands.push_back(band);
+        y += image.rows + pad;
+    }
+
+    tesseract::TessBaseAPI* tesseract_api = acquireOcrEngine("batch:" + type);
+    tesseract_api->SetImage((uchar*) composite.data, composite.cols, composite.rows, 1, composite.step);
+    if(tesseract_api->Recognize(0) != 0){
+        releaseOcrEngine("batch:" + type,tesseract_api);
+        std::cerr << "Could not recognize a composite of " << pending.size() << " regions, recognizing them one by one" << std::endl;
+        for(size_t p = 0; p < pending.size(); p++){
+            recognizeAlone(*pending[p]);
+        }
+        return;
+    }
+
+    /// Text lines are mapped back to the region whose band contains them entirely
+    /// Regions overlapped by a line crossing bands, as when lines are merged, are recognized alone
+    std::vector<std::string> texts(pending.size());
+    std::vector<float> confidences(pending.size(),0);
+    std::vector<int> lines(pending.size(),0);
+    std::vector<uchar> crossed(pending.size(),0);
+    tesseract::ResultIterator* iterator = tesseract_api->GetIterator();
+    if(iterator){
+        do{
+            if(iterator->Empty(tesseract::RIL_TEXTLINE)) continue;
+            int left, top, right, bottom;
+            iterator->BoundingBox(tesseract::RIL_TEXTLINE, &left, &top, &right, &bottom);
+            for(size_t p = 0; p < bands.size(); p++){
+                bool overlaps = top < bands[p].y + bands[p].height && bottom > bands[p].y;
+                if(overlaps && (top < bands[p].y || bottom > bands[p].y + bands[p].height)){
+                    crossed[p] = 1;
+                }
+            }
+            for(size_t p = 0; p < bands.size(); p++){
+                if(top >= bands[p].y && bottom <= bands[p].y + bands[p].height){
+                    char* line = iterator->GetUTF8Text(tesseract::RIL_TEXTLINE);
+                    if(line){
+                        texts[p] += line;
+                        delete[] line;
+                    }
+                    confidences[p] += iterator->Confidence(tesseract::RIL_TEXTLINE);
+                    lines[p]++;
+                    break;
+                }
+            }
+        } while(iterator->Next(tesseract::RIL_TEXTLINE));
+        delete iterator;
+    }
+    releaseOcrEngine("batch:" + type,tesseract_api);
+
+    addStatistic("ocr/batches", 1);
+    addStatistic("ocr/batched regions", pending.size());
+
+    /// Composites are read as one block, so their texts are not cached under the keys of regions read alone
+    for(size_t p = 0; p < pending.size(); p++){
+        if(lines[p] == 0 || crossed[p]){
+            recognizeAlone(*pending[p]);
+            continue;
+        }
+        if(useGlyphs(*pending[p])){
+            pending[p]->learn_text = texts[p];
+            pending[p]->learn_confidence = (int)(confidences[p]/lines[p]);
+        }
+        finishText(*pending[p],texts[p]);
+    }
+}
+
+void InspectorWidgetProcessor::finishText(InspectorWidgetOcrJob& job, std::string text){
+    std::stringstream job_log;
+
+    //std::cout << "Text: " << text << std::endl;
+
+    /* Split the string by whitespace */
+    vector<string> splitted;
+    istringstream iss( text );
+    copy( istream_iterator<string>(iss), istream_iterator<string>(), back_inserter( splitted ) );
+
+    int n_words = splitted.size();
+    job_log << n_words << " word(s)" << std::endl;
+
+    job_log << "Detected text: '" << text << "'" << std::endl;
+
+    if(text.empty())
+        text = " ";
+
+    text.erase (std::remove(text.begin(), text.end(), '\n'), text.end());
+    text.erase (std::remove(text.begin(), text.end(), ','), text.end());
+
+    if( job.type == "detectNumber"){
+        if(n_words!=1){
+            text = " ";
+        }
+        else{
+            text = splitted[0];
+        }
+    }
+    //                else if( job.type == "detectTime"){
+
+    //                }
+
+    job_log << "Processed text: '" << text << "'" << std::endl;
+
+    job.text = text;
+    job.log = job_log.str();
+}
+
+void InspectorWidgetProcessor::submitOcrJobs(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >& jobs){
+    std::unique_lock<std::mutex> lock(ocr_jobs_mutex);
+    if(!ocr_workers.empty()){
+        for(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = jobs.begin(); _j != jobs.end(); _j++){
+            /// Bounded number of regions waiting for or under recognition
+            ocr_jobs_condition.wait(lock,[&](){ return ocr_jobs_in_flight < ocr_jobs_max_in_flight; });
+            ocr_jobs_in_flight++;
+            ocr_jobs.push_back(*_j);
+            ocr_jobs_condition.notify_all();
+        }
+        jobs.clear();
+        return;
+    }
+    lock.unlock();
+
+    /// Without OCR workers, regions of the same OCR type in this frame can be recognized together
+    if(ocr_batch){
+        std::map<int,std::vector<std::shared_ptr<InspectorWidgetOcrJob> > > batches;
+        for(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = jobs.begin(); _j != jobs.end(); _j++){
+            batches[annotation_table.text_type_id[(*_j)->region]].push_back(*_j);
+        }
+        for(std::map<int,std::vector<std::shared_ptr<InspectorWidgetOcrJob> > >::iterator _b = batches.begin(); _b != batches.end(); _b++){
+            recognizeTextBatch(_b->second);
+        }
+    }
+    else{
+        for(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = jobs.begin(); _j != jobs.end(); _j++){
+            recognizeText(**_j);
+        }
+    }
+    for(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = jobs.begin(); _j != jobs.end(); _j++){
+        (*_j)->done = true;
+    }
+    jobs.clear();
+}
+
+void InspectorWidgetProcessor::waitOcrJob(std::shared_ptr<InspectorWidgetOcrJob> job){
+    std::unique_lock<std::mutex> lock(ocr_jobs_mutex);
+    ocr_jobs_condition.wait(lock,[&](){ return job->done; });
+}
+
+void InspectorWidgetProcessor::startOcrWorkers(int workers, int max_in_flight){
+    stopOcrWorkers();
+    if(workers < 1){
+        return;
+    }
+    ocr_jobs_stop = false;
+    ocr_jobs_in_flight = 0;
+    ocr_jobs_max_in_flight = std::max(1,max_in_flight);
+    std::cout << "OCR with " << workers << " worker(s) and at most " << ocr_jobs_max_in_flight << " regions in flight" << std::endl;
+    for(int w = 0; w < workers; w++){
+        ocr_workers.push_back(std::thread([this](){
+            bool batching = ocr_batch;
+            size_t batch_size = (size_t)ocr_batch_size;
+            while(true){
+                std::vector<std::shared_ptr<InspectorWidgetOcrJob> > batch;
+                {
+                    std::unique_lock<std::mutex> lock(ocr_jobs_mutex);
+                    ocr_jobs_condition.wait(lock,[&](){ return ocr_jobs_stop || !ocr_jobs.empty(); });
+                    if(ocr_jobs.empty()) return;
+                    batch.push_back(ocr_jobs.front());
+                    ocr_jobs.pop_front();
+
+                    /// Queued regions of the same OCR type, from this frame or the next ones, are recognized together
+                    for(std::deque<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = ocr_jobs.begin(); batching && _j != ocr_jobs.end() && batch.size() < batch_size; ){
+                        if(annotation_table.text_type_id[(*_j)->region] == annotation_table.text_type_id[batch[0]->region]){
+                            batch.push_back(*_j);
+                            _j = ocr_jobs.erase(_j);
+                        }
+                        else{
+                            _j++;
+                        }
+                    }
+                }
+                try{
+                    if(batch.size() > 1){
+                        recognizeTextBatch(batch);
+                    }
+                    else{
+                        recognizeText(*batch[0]);
+                    }
+                }
+                catch(std::exception& e){
+                    for(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = batch.begin(); _j != batch.end(); _j++){
+                        std::stringstream msg;
+                        msg << "Text recognition of frame " << (*_j)->frame << " failed: " << e.what() << std::endl;
+                        (*_j)->log = msg.str();
+                        (*_j)->text = " ";
+                    }
+                }
+                {
+                    std::unique_lock<std::mutex> lock(ocr_jobs_mutex);
+                    for(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >::iterator _j = batch.begin(); _j != batch.end(); _j++){
+                        (*_j)->image.release();
+                        (*_j)->done = true;
+                    }
+                    ocr_jobs_in_flight -= batch.size();
+                }
+                ocr_jobs_condition.notify_all();
+            }
+        }));
+    }
+}
+
+void InspectorWidgetProcessor::stopOcrWorkers(){
+    {
+        std::unique_lock<std::mutex> lock(ocr_jobs_mutex);
+        ocr_jobs_stop = true;
+    }
+    ocr_jobs_condition.notify_all();
+    for(std::vector<std::thread>::iterator _w = ocr_workers.begin(); _w != ocr_workers.end(); _w++){
+        _w->join();
+    }
+    ocr_workers.clear();
+}
+
+void InspectorWidgetProcessor::internAnnotations(){
+    InspectorWidgetAnnotationTable table;
+    table.gating = getSetting("gating",1) > 0;
+    table.benchmark_matching = getSetting("benchmarkMatching",0) > 0;
+    table.benchmark_overhead = getSetting("benchmarkOverhead",0) > 0;
+    table.gating_block_size = std::max(1,(int)getSetting("gatingBlockSize",16));
+    table.ncc_kernel = getSetting("nccKernel",1) > 0;
+    int kernel_level = (int)getSetting("nccKernelLevel",-1);
+    table.ncc_kernel_level = (kernel_level < 0) ? nccKernelLevel() : (InspectorWidgetNccKernelLevel)std::min(kernel_level, (int)nccKernelLevel());
+    table.ncc_kernel_size = std::min(ncc_kernel_max_size, (int)getSetting("nccKernelSize",24));
+    table.benchmark_kernel = getSetting("benchmarkKernel",0) > 0;
+    table.prefilter_block_size = std::max(1,(int)getSetting("prefilterBlockSize",8));
+    table.workspace_reserved = internStatistic("workspace/reserved");
+    table.workspace_allocations = internStatistic("workspace/allocations");
+    table.overhead_frames = internStatistic("overhead/frames");
+    table.overhead_time = internStatistic("overhead/time");
+    table.overhead_image_time = internStatistic("overhead/image time");
+
+    /// Annotations of both lists first, so that dependencies can be resolved to them
+    std::map<std::string,int> annotation_ids;
+    std::map<std::string,int> template_ids;
+    std::vector<std::string> text_names(text_detect_list.begin(),text_detect_list.end());
+    std::vector<std::string> names(template_list.begin(),template_list.end());
+    names.insert(names.end(),text_names.begin(),text_names.end());
+    for(std::vector<std::string>::iterator _n = names.begin(); _n != names.end(); _n++ ){
+        if(annotation_ids.find(*_n) != annotation_ids.end()) continue;
+        annotation_ids[*_n] = table.annotation_names.size();
+        table.annotation_names.push_back(*_n);
+        table.annotation_progress.push_back(&annotation_progress[*_n]);
+    }
+    for(size_t _index = 0; _index < template_list.size(); _index++ ){
+        template_ids[template_list[_index]] = _index;
+    }
+
+    std::map<std::string,int> logged_ids;
+    for(std::map<std::string, std::vector<float> >::iterator _l = log_val.begin(); _l != log_val.end(); _l++ ){
+        logged_ids[_l->first] = table.logged_val.size();
+        table.logged_val.push_back(&_l->second);
+        table.logged_x.push_back(&log_x[_l->first]);
+        table.logged_y.push_back(&log_y[_l->first]);
+        table.logged_w.push_back(logged_template_w[_l->first]);
+        table.logged_h.push_back(logged_template_h[_l->first]);
+    }
+
+    /// Lookups that fall back to -1 for names that are not part of a list
+    struct Ids {
+        static int find(std::map<std::string,int>& ids, const std::string& name){
+            std::map<std::string,int>::iterator _i = ids.find(name);
+            return (_i != ids.end()) ? _i->second : -1;
+        }
+        static std::vector<int> resolve(std::map<std::string,int>& ids, const std::vector<std::string>& names){
+            std::vector<int> resolved;
+            for(std::vector<std::string>::const_iterator _n = names.begin(); _n != names.end(); _n++ ){
+                resolved.push_back(find(ids,*_n));
+            }
+            return resolved;
+        }
+    };
+
+    const char* statistic_keys[STAT_TEMPLATE_COUNT][2] = {
+        {"gating/","/skipped"}, {"gating/","/matched"},
+        {"tracking/","/hits"}, {"tracking/","/misses"},
+        {"dirty/","/full"}, {"dirty/","/incremental"}, {"dirty/","/searched"}, {"dirty/","/region"},
+        {"scale/","/coarse"}, {"scale/","/refined"},
+        {"prefilter/","/positions"}, {"prefilter/","/searched"}, {"prefilter/","/skipped"},
+        {"exact/","/hits"}, {"exact/","/fallbacks"},
+        {"fft/","/matches"}
+    };
+
+    for(size_t _index = 0; _index < template_list.size(); _index++ ){
+        std::string _name = template_list[_index];
+        table.template_annotation.push_back(annotation_ids[_name]);
+
+        std::string test = template_matching_test[_name];
+        int region = REGION_FRAME;
+        if(test == "inrect") region = REGION_INRECT;
+        else if(test == "below") region = REGION_BELOW;
+        else if(test == "rightof") region = REGION_RIGHTOF;
+        table.template_test.push_back(region);
+        table.template_always.push_back(test.empty());
+
+        std::map<std::string,std::vector<int> >::iterator _rect = inrect_map.find(_name);
+        table.template_inrect.push_back(_rect != inrect_map.end());
+        table.template_rect.push_back((_rect != inrect_map.end() && _rect->second.size() >= 4) ? cv::Rect(_rect->second[0],_rect->second[1],_rect->second[2],_rect->second[3]) : cv::Rect());
+        table.template_w.push_back(template_w[_name]);
+        table.template_h.push_back(template_h[_name]);
+
+        std::vector<int> logged_deps = Ids::resolve(logged_ids,template_matching_logged_dep_map[_name]);
+        logged_deps.erase(std::remove(logged_deps.begin(),logged_deps.end(),-1),logged_deps.end());
+        table.template_logged_deps.push_back(logged_deps);
+        table.template_new_deps.push_back(Ids::resolve(template_ids,template_matching_new_dep_map[_name]));
+
+        /// Below and rightof tests place the region next to their single dependency, logged values first
+        std::vector<std::string>& deps = template_matching_dep_map[_name];
+        int anchor = -1;
+        int source = ANCHOR_NOT_SINGLE;
+        if(deps.size() == 1){
+            if((anchor = Ids::find(logged_ids,deps[0])) >= 0){
+                source = ANCHOR_LOGGED;
+            }
+            else if((anchor = Ids::find(template_ids,deps[0])) >= 0){
+                source = ANCHOR_TEMPLATE;
+            }
+            else{
+                source = ANCHOR_MISSING;
+            }
+        }
+        table.template_anchor.push_back(anchor);
+        table.template_anchor_source.push_back(source);
+
+        table.gray_templates.push_back(gray_templates[_name]);
+        table.gray_template_pyramids.push_back(gray_template_pyramids[_name]);
+        table.dirty_matching.push_back(getSetting("dirtyMatching",0,_name) > 0);
+        table.tracking.push_back(getSetting("tracking",0,_name) > 0);
+        table.tracking_fallback.push_back(getSetting("trackingFallback",1,_name) > 0);
+        table.tracking_window.push_back((int)getSetting("trackingWindow",32,_name));
+        table.prune_candidates.push_back((int)getSetting("pruneCandidates",5,_name));
+        table.prune_threshold.push_back(getSetting("pruneThreshold",fastMatchPruningThreshold(match_method),_name));
+        table.analysis_level.push_back((int)getSetting("analysisLevel",0,_name));
+        table.analysis_margin.push_back(getSetting("analysisMargin",0.1,_name));
+        table.prefilter.push_back(getSetting("prefilter",0,_name) > 0);
+        table.prefilter_contrast.push_back(getSetting("prefilterContrast",0,_name));
+        table.prefilter_brightness.push_back(getSetting("prefilterBrightness",255,_name));
+        std::vector<double> means, stddevs;
+        std::vector<cv::Mat>& tpls = gray_template_pyramids[_name];
+        for(size_t level = 0; level < tpls.size(); level++){
+            cv::Scalar mean, stddev;
+            cv::meanStdDev(tpls[level], mean, stddev);
+            means.push_back(mean[0]);
+            stddevs.push_back(stddev[0]);
+        }
+        table.template_means.push_back(means);
+        table.template_stddevs.push_back(stddevs);
+        table.exact_matching.push_back(getSetting("exactMatch",0,_name) > 0);
+        table.exact_hashes.push_back(rollingHash(gray_templates[_name]));
+        table.template_debug_path.push_back(this->datapath + this->videostem + "-" + _name + ".png");
+
+        std::vector<double*> counters;
+        for(int _s = 0; _s < STAT_TEMPLATE_COUNT; _s++){
+            counters.push_back(internStatistic(statistic_keys[_s][0] + _name + statistic_keys[_s][1]));
+        }
+        table.template_statistics.push_back(counters);
+
+        table.template_x.push_back(&template_x[_name]);
+        table.template_y.push_back(&template_y[_name]);
+        table.template_val.push_back(&template_val[_name]);
+        table.template_vals.push_back(&template_vals[_name]);
+        table.template_csv.push_back(&csvfile[_name]);
+    }
+
+    for(size_t _index = 0; _index < text_names.size(); _index++ ){
+        std::string _name = text_names[_index];
+        table.text_annotation.push_back(annotation_ids[_name]);
+
+        std::string test = text_detect_test[_name];
+        table.text_test.push_back(test == "inrect" ? REGION_INRECT : (test == "between" ? REGION_BETWEEN : -1));
+
+        std::map<std::string,std::vector<int> >::iterator _rect = inrect_map.find(_name);
+        table.text_inrect.push_back(_rect != inrect_map.end());
+        table.text_rect.push_back((_rect != inrect_map.end() && _rect->second.size() >= 4) ? cv::Rect(_rect->second[0],_rect->second[1],_rect->second[2],_rect->second[3]) : cv::Rect());
+
+        std::vector<int> logged_deps = Ids::resolve(logged_ids,text_detect_logged_dep_map[_name]);
+        logged_deps.erase(std::remove(logged_deps.begin(),logged_deps.end(),-1),logged_deps.end());
+        table.text_logged_deps.push_back(logged_deps);
+        table.text_new_deps.push_back(Ids::resolve(template_ids,text_detect_new_dep_map[_name]));
+
+        std::string type = text_detect_type[_name];
+        table.text_type.push_back(type);
+        table.text_threshold.push_back(type == "detectTime" || type == "detectText");
+
+        size_t type_id = std::find(table.text_types.begin(), table.text_types.end(), type) - table.text_types.begin();
+        if(type_id == table.text_types.size()){
+            table.text_types.push_back(type);
+        }
+        table.text_type_id.push_back((int)type_id);
+        table.text_glyphs.push_back((type == "detectNumber" || type == "detectTime") && getSetting("glyphs",0,_name) > 0);
+        table.text_glyph_threshold.push_back(getSetting("glyphThreshold",0.85,_name));
+        table.text_glyph_confidence.push_back((int)getSetting("glyphLearnConfidence",80,_name));
+        const char* glyph_statistic_keys[STAT_GLYPH_COUNT] = {"recognized", "fallbacks", "time", "tesseract time", "agreed"};
+        std::vector<double*> glyph_counters(STAT_GLYPH_COUNT);
+        for(int _s = 0; _s < STAT_GLYPH_COUNT; _s++){
+            glyph_counters[_s] = internStatistic("glyphs/" + type + "/" + glyph_statistic_keys[_s]);
+        }
+        table.text_glyph_statistics.push_back(glyph_counters);
+
+        table.text_x.push_back(&text_x[_name]);
+        table.text_y.push_back(&text_y[_name]);
+        table.text_txt.push_back(&text_txt[_name]);
+        table.text_csv.push_back(&csvfile[_name]);
+    }
+    table.text_debug_path = this->datapath + this->videostem + "-detecttext.png";
+    table.benchmark_glyphs = getSetting("benchmarkGlyphs",0) > 0;
+    {
+        std::unique_lock<std::mutex> lock(glyphs_mutex);
+        glyph_templates.assign(table.text_types.size(), std::shared_ptr<const std::map<char,cv::Mat> >(new std::map<char,cv::Mat>()));
+    }
+
+    /// Largest matching results per pyramid level, those of the smallest template over the whole frame
+    cv::Size level_frame(this->video_w, this->video_h);
+    for(int level = 0; level <= fastmatchlevels + analysislevels; level++){
+        cv::Size smallest(level_frame);
+        for(size_t _index = 0; _index < table.gray_template_pyramids.size(); _index++ ){
+            std::vector<cv::Mat>& tpls = table.gray_template_pyramids[_index];
+            if(level < (int)tpls.size()){
+                smallest.width = std::min(smallest.width, tpls[level].cols);
+                smallest.height = std::min(smallest.height, tpls[level].rows);
+            }
+        }
+        table.workspace_sizes.push_back(cv::Size(std::max(1, level_frame.width - smallest.width + 1), std::max(1, level_frame.height - smallest.height + 1)));
+        table.fft_frame_sizes.push_back(level_frame);
+        table.fft_sizes.push_back(cv::Size(cv::getOptimalDFTSize(level_frame.width), cv::getOptimalDFTSize(level_frame.height)));
+        level_frame = cv::Size((level_frame.width + 1)/2, (level_frame.height + 1)/2);
+    }
+
+    /// Frequency-domain correlation replaces spatial matching of the coarsest full frame level where the cost model finds it cheaper:
+    /// spatial matching costs a multiply-add per template pixel and position, correlation an inverse transform of the padded level
+    double fft_cost = getSetting("fftCost",8);
+    for(size_t _index = 0; _index < template_list.size(); _index++ ){
+        std::vector<cv::Mat>& tpls = table.gray_template_pyramids[_index];
+        int mode = (int)getSetting("fftMatching",-1,template_list[_index]);
+        int level = 0;
+        if(!tpls.empty()){
+            /// Coarsest level reached by matchTemplates for a full frame search
+            int levels = fastmatchlevels;
+            if(this->video_w - tpls[0].cols <= 1 || this->video_h - tpls[0].rows <= 1){
+                levels = 0;
+            }
+            int scale_level = std::min(table.analysis_level[_index], analysislevels);
+            while(scale_level > 0 && (tpls[scale_level].cols < 8 || tpls[scale_level].rows < 8)){
+                scale_level--;
+            }
+            while(level < scale_level + levels && level + 1 < (int)tpls.size() && level + 1 < (int)table.fft_frame_sizes.size()
+                  && table.fft_frame_sizes[level+1].width >= tpls[level+1].cols && table.fft_frame_sizes[level+1].height >= tpls[level+1].rows){
+                level++;
+            }
+        }
+        bool fft = false;
+        if(mode != 0 && !tpls.empty() && level < (int)table.fft_frame_sizes.size()){
+            cv::Size result = table.fft_frame_sizes[level] + cv::Size(1,1) - tpls[level].size();
+            double spatial = (double)result.area()*tpls[level].size().area();
+            double padded = (double)table.fft_sizes[level].area();
+            fft = result.width > 0 && result.height > 0 && (mode > 0 || fft_cost*padded*std::log(padded)/std::log(2.0) < spatial);
+        }
+        table.fft_matching.push_back(fft);
+        table.fft_level.push_back(level);
+        cv::Mat spectrum;
+        double sum = 0, sqsum = 0;
+        if(fft){
+            const cv::Mat& tpl = tpls[level];
+            cv::Mat padded = cv::Mat::zeros(table.fft_sizes[level], CV_32F);
+            cv::Mat inner = padded(cv::Rect(0, 0, tpl.cols, tpl.rows));
+            sum = cv::sum(tpl)[0];
+            sqsum = cv::norm(tpl, NORM_L2);
+            sqsum *= sqsum;
+            /// Coefficient methods correlate the zero-mean template, which avoids cancellation in single precision
+            bool coeff = (match_method == TM_CCOEFF || match_method == TM_CCOEFF_NORMED);
+            tpl.convertTo(inner, CV_32F, 1, coeff ? -sum/tpl.size().area() : 0);
+            cv::dft(padded, spectrum, 0, tpl.rows);
+        }
+        table.template_spectra.push_back(spectrum);
+        table.fft_template_sum.push_back(sum);
+        table.fft_template_sqsum.push_back(sqsum);
+    }
+
+    /// Checks of the sampled loop, names outside both lists never require processing
+    for(size_t _index = 0; _index < template_list.size(); _index++ ){
+        if(table.template_always[_index]){
+            table.always_annotations.push_back(table.template_annotation[_index]);
+        }
+        if(table.template_inrect[_index]){
+            table.inrect_annotations.push_back(table.template_annotation[_index]);
+        }
+    }
+    for(size_t _index = 0; _index < text_names.size(); _index++ ){
+        if(table.text_inrect[_index]){
+            table.text_inrect_annotations.push_back(table.text_annotation[_index]);
+        }
+    }
+    for(std::list<std::string>::iterator _d = template_matching_logged_dep_list.begin(); _d != template_matching_logged_dep_list.end(); _d++ ){
+        int annotation = Ids::find(annotation_ids,*_d);
+        int logged = Ids::find(logged_ids,*_d);
+        if(annotation >= 0 && logged >= 0){
+            table.template_logged_checks.push_back(std::make_pair(logged,annotation));
+        }
+    }
+    for(std::list<std::string>::iterator _d = template_matching_new_dep_list.begin(); _d != template_matching_new_dep_list.end(); _d++ ){
+        int annotation = Ids::find(annotation_ids,*_d);
+        if(annotation >= 0){
+            table.template_new_checks.push_back(annotation);
+        }
+    }
+    for(std::list<std::string>::iterator _d = text_detect_new_dep_list.begin(); _d != text_detect_new_dep_list.end(); _d++ ){
+        int annotation = Ids::find(annotation_ids,*_d);
+        if(annotation >= 0){
+            table.template_new_checks.push_back(annotation);
+            table.text_new_checks.push_back(std::make_pair(Ids::find(template_ids,*_d),annotation));
+        }
+    }
+    for(std::list<std::string>::iterator _d = text_detect_logged_dep_list.begin(); _d != text_detect_logged_dep_list.end(); _d++ ){
+        int annotation = Ids::find(annotation_ids,*_d);
+        int logged = Ids::find(logged_ids,*_d);
+        if(annotation >= 0 && logged >= 0){
+            table.text_logged_checks.push_back(std::make_pair(logged,annotation));
+        }
+    }
+
+    annotation_table = table;
+}
+
+void InspectorWidgetProcessor::prepareFrameContext(InspectorWidgetFrameContext& ctx){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    ctx.frame = frame;
+    ctx.csv_frame = csv_frame;
+    ctx.status_progress = status_progress;
+    ctx.result.reset(frame,template_list.size(),text_detect_list.size());
+
+    /// Analyses start from the committed values, then only update their own copies
+    size_t templates = table.template_annotation.size();
+    size_t texts = table.text_annotation.size();
+    ctx.template_x.resize(templates);
+    ctx.template_y.resize(templates);
+    ctx.template_val.resize(templates);
+    ctx.match_records.resize(templates);
+    for(size_t _index = 0; _index < templates; _index++ ){
+        ctx.template_x[_index] = *table.template_x[_index];
+        ctx.template_y[_index] = *table.template_y[_index];
+        ctx.template_val[_index] = *table.template_val[_index];
+    }
+    ctx.text_x.resize(texts);
+    ctx.text_y.resize(texts);
+    for(size_t _index = 0; _index < texts; _index++ ){
+        ctx.text_x[_index] = *table.text_x[_index];
+        ctx.text_y[_index] = *table.text_y[_index];
+    }
+    ctx.annotation_progress.resize(table.annotation_progress.size());
+    for(size_t _index = 0; _index < table.annotation_progress.size(); _index++ ){
+        ctx.annotation_progress[_index] = *table.annotation_progress[_index];
+    }
+
+    ctx.workspace.kernel = table.ncc_kernel;
+    ctx.workspace.kernel_level = table.ncc_kernel_level;
+    ctx.workspace.kernel_size = table.ncc_kernel_size;
+
+    /// Each analysis thread has its own context, so its workspace is sized once here
+    if(!table.template_annotation.empty()){
+        int reserved = ctx.workspace.allocations;
+        ctx.workspace.reserve(table.workspace_sizes);
+        addStatistic(table.workspace_reserved, ctx.workspace.allocations - reserved);
+        ctx.workspace.reported_allocations = ctx.workspace.allocations;
+    }
+}
+
+void InspectorWidgetProcessor::writeDebugImages(InspectorWidgetFrameResult& result){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    for(size_t _image = 0; _image < result.debug_images.size(); _image++ ){
+        if(result.debug_images[_image].empty()) continue;
+        std::string& imagefile = (_image < table.template_debug_path.size()) ? table.template_debug_path[_image] : table.text_debug_path;
+        cv::imwrite(imagefile.c_str(),result.debug_images[_image]);
+        result.debug_images[_image].release();
+    }
+}
+
+void InspectorWidgetProcessor::commitTemplateMatches(InspectorWidgetFrameResult& result){
+    writeDebugImages(result);
+    std::cout << result.log;
+    result.log.clear();
+    writeTemplateMatches(result, result.frame);
+}
+
+void InspectorWidgetProcessor::writeTemplateMatches(const InspectorWidgetFrameResult& result, int committed){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    for(size_t _index = 0; _index < table.template_annotation.size() && _index < result.template_processed.size(); _index++ ){
+        if(!result.template_processed[_index]) continue;
+
+        float& _x = *table.template_x[_index];
+        float& _y = *table.template_y[_index];
+        float& _val = *table.template_val[_index];
+        _x = result.template_x[_index];
+        _y = result.template_y[_index];
+        _val = result.template_val[_index];
+
+        if(result.template_matched[_index]){
+            std::vector<float>& _vals = *table.template_vals[_index];
+            if(_vals.size() == 0){
+                std::cout << "Init storage of values from template " << template_list[_index] << std::endl;
+                _vals.resize(this->video_frames,0.0);
+            }
+            _vals[committed] = _val;
+        }
+
+        file << "," << _x;
+        file << "," << _y;
+        file << "," << _val;
+
+        std::ofstream& _csvfile = *table.template_csv[_index];
+        _csvfile << committed;
+        _csvfile << "," << _x;
+        _csvfile << "," << _y;
+        _csvfile << "," << _val;
+        _csvfile << std::endl;
+
+        *table.annotation_progress[table.template_annotation[_index]] = (float)committed/(float)this->video_frames;
+    }
+}
+
+void InspectorWidgetProcessor::commitTextDetections(InspectorWidgetFrameResult& result){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    for(size_t _index = 0; _index < result.text_jobs.size(); _index++ ){
+        std::shared_ptr<InspectorWidgetOcrJob> job = result.text_jobs[_index];
+        if(!job) continue;
+        waitOcrJob(job);
+        /// Glyphs are learned here rather than by OCR workers so that they come from frames in order
+        if(job->learn_confidence >= 0){
+            learnGlyphs(*job,job->learn_text,job->learn_confidence);
+        }
+        result.text_txt[_index] = job->text;
+        result.log += job->log;
+        result.text_jobs[_index].reset();
+    }
+
+    writeDebugImages(result);
+    std::cout << result.log;
+    result.log.clear();
+
+    for(size_t _index = 0; _index < table.text_annotation.size() && _index < result.text_processed.size(); _index++ ){
+        if(!result.text_processed[_index]) continue;
+
+        std::string& _txt = *table.text_txt[_index];
+        float& _x = *table.text_x[_index];
+        float& _y = *table.text_y[_index];
+        _txt = result.text_txt[_index];
+        _x = result.text_x[_index];
+        _y = result.text_y[_index];
+
+        file << "," << _x;
+        file << "," << _y;
+        file << "," << _txt;
+
+        std::ofstream& _csvfile = *table.text_csv[_index];
+        _csvfile << result.frame;
+        _csvfile << "," << _x;
+        _csvfile << "," << _y;
+        _csvfile << "," << _txt;
+        _csvfile << std::endl;
+
+        *table.annotation_progress[table.text_annotation[_index]] = (float)result.frame/(float)this->video_frames;
+    }
+}
+
+void InspectorWidgetProcessor::commitFrameResult(InspectorWidgetFrameResult& result){
+    commitTemplateMatches(result);
+    commitTextDetections(result);
+}
+
+void InspectorWidgetProcessor::analyzeFrame(InspectorWidgetFrameContext& ctx, int f){
+    int64 start = getTickCount();
+    ctx.frame = f;
+    ctx.status_progress = (float)f/(float)this->video_frames;
+    ctx.result.reset(f,template_list.size(),text_detect_list.size());
+    this->matchTemplates(ctx);
+    this->detectText(ctx);
+    ctx.result.analysis_time = (double)(getTickCount()-start)/getTickFrequency();
+}
+
+void InspectorWidgetProcessor::updateChangedBlocks(InspectorWidgetFrameContext& ctx){
+    ctx.block_size = annotation_table.gating_block_size;
+    ctx.changes_valid = !ctx.previous_gray.empty() && ctx.previous_gray.size() == ctx.ref_gray.size() && ctx.previous_gray.type() == ctx.ref_gray.type();
+    if(!ctx.changes_valid){
+        return;
+    }
+    int block = ctx.block_size;
+    int cols = ctx.ref_gray.cols;
+    ctx.block_cols = (cols + block - 1)/block;
+    int block_rows = (ctx.ref_gray.rows + block - 1)/block;
+    ctx.changed_blocks.assign(ctx.block_cols*block_rows,0);
+    for(int y = 0; y < ctx.ref_gray.rows; y++){
+        const uchar* current = ctx.ref_gray.ptr(y);
+        const uchar* previous = ctx.previous_gray.ptr(y);
+        uchar* changed = &ctx.changed_blocks[(y/block)*ctx.block_cols];
+        for(int bx = 0; bx < ctx.block_cols; bx++){
+            int x = bx*block;
+            if(!changed[bx] && memcmp(current + x, previous + x, std::min(block, cols - x)) != 0){
+                changed[bx] = 1;
+            }
+        }
+    }
+}
+
+bool InspectorWidgetProcessor::regionUnchanged(InspectorWidgetFrameContext& ctx, cv::Rect region){
+    if(!ctx.changes_valid){
+        return false;
+    }
+    region &= cv::Rect(0, 0, ctx.ref_gray.cols, ctx.ref_gray.rows);
+    if(region.width <= 0 || region.height <= 0){
+        return false;
+    }
+    int block = ctx.block_size;
+    for(int by = region.y/block; by <= (region.y + region.height - 1)/block; by++){
+        for(int bx = region.x/block; bx <= (region.x + region.width - 1)/block; bx++){
+            if(ctx.changed_blocks[by*ctx.block_cols + bx]){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<cv::Rect>& InspectorWidgetProcessor::dirtyRects(InspectorWidgetFrameContext& ctx){
+    if(ctx.dirty_analysis == ctx.analyses){
+        return ctx.dirty_rects;
+    }
+    ctx.dirty_analysis = ctx.analyses;
+    ctx.dirty_rects.clear();
+    if(!ctx.changes_valid){
+        return ctx.dirty_rects;
+    }
+
+    /// Bounding boxes of the 8-connected groups of changed blocks
+    int block = ctx.block_size;
+    int block_rows = ctx.changed_blocks.size()/ctx.block_cols;
+    std::vector<uchar>& visited = ctx.dirty_visited;
+    visited.assign(ctx.changed_blocks.size(),0);
+    std::vector<int>& stack = ctx.dirty_stack;
+    stack.clear();
+    for(int start = 0; start < (int)ctx.changed_blocks.size(); start++){
+        if(!ctx.changed_blocks[start] || visited[start]) continue;
+        int x0 = start%ctx.block_cols, x1 = x0, y0 = start/ctx.block_cols, y1 = y0;
+        visited[start] = 1;
+        stack.push_back(start);
+        while(!stack.empty()){
+            int b = stack.back();
+            stack.pop_back();
+            int bx = b%ctx.block_cols, by = b/ctx.block_cols;
+            x0 = std::min(x0,bx); x1 = std::max(x1,bx);
+            y0 = std::min(y0,by); y1 = std::max(y1,by);
+            for(int ny = std::max(0,by-1); ny <= std::min(block_rows-1,by+1); ny++){
+                for(int nx = std::max(0,bx-1); nx <= std::min(ctx.block_cols-1,bx+1); nx++){
+                    int n = ny*ctx.block_cols + nx;
+                    if(ctx.changed_blocks[n] && !visited[n]){
+                        visited[n] = 1;
+                        stack.push_back(n);
+                    }
+                }
+            }
+        }
+        cv::Rect dirty(x0*block, y0*block, (x1-x0+1)*block, (y1-y0+1)*block);
+        ctx.dirty_rects.push_back(dirty & cv::Rect(0, 0, ctx.ref_gray.cols, ctx.ref_gray.rows));
+    }
+    return ctx.dirty_rects;
+}
+
+bool InspectorWidgetProcessor::matchTrackingWindow(InspectorWidgetFrameContext& ctx, size_t index, cv::Rect region, cv::Mat& templ, InspectorWidgetMatchRecord& record, double& minVal, double& maxVal, cv::Point& matchLoc, double& matchVal){
+    /// Widgets rarely jump, so the last match position is searched first
+    if(record.analysis < 0 || record.val <= _threshold){
+        return false;
+    }
+    cv::Rect previous_region = (record.rect.width > 0 && record.rect.height > 0) ? record.rect : cv::Rect(0, 0, ctx.ref_gray.cols, ctx.ref_gray.rows);
+    int radius = annotation_table.tracking_window[index];
+    cv::Rect window(previous_region.x + record.loc.x - radius, previous_region.y + record.loc.y - radius, templ.cols + 2*radius, templ.rows + 2*radius);
+    window &= region;
+    if(window.width < templ.cols || window.height < templ.rows){
+        return false;
+    }
+
+    cv::Mat res = ctx.workspace.buffer(ctx.workspace.window, window.size() + cv::Size(1,1) - templ.size(), CV_32FC1);
+    cv::matchTemplate(ctx.ref_gray(window), templ, res, match_method);
+    Point minLoc; Point maxLoc;
+    minMaxLoc( res, &minVal, &maxVal, &minLoc, &maxLoc, Mat() );
+    bool lower = ( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED );
+    matchVal = lower ? minVal : maxVal;
+    Point loc = lower ? minLoc : maxLoc;
+    matchLoc = Point(window.x - region.x + loc.x, window.y - region.y + loc.y);
+
+    std::vector<double*>& counters = annotation_table.template_statistics[index];
+    if(matchVal > _threshold){
+        addStatistic(counters[STAT_TRACKING_HITS], 1);
+        return true;
+    }
+    addStatistic(counters[STAT_TRACKING_MISSES], 1);
+
+    /// On a miss, the full search runs unless the fallback is disabled for this template
+    return !annotation_table.tracking_fallback[index];
+}
+
+bool InspectorWidgetProcessor::matchDirtyRegions(InspectorWidgetFrameContext& ctx, size_t index, cv::Rect region, cv::Mat& templ, InspectorWidgetMatchRecord& record, double& minVal, double& maxVal, cv::Point& matchLoc, double& matchVal){
+    /// The previous best match still holds if none of its pixels changed,
+    /// new occurrences can then only overlap dirty rects
+    std::vector<cv::Rect>& dirty_rects = dirtyRects(ctx);
+    std::vector<double*>& counters = annotation_table.template_statistics[index];
+    cv::Rect previous(region.x + record.loc.x, region.y + record.loc.y, templ.cols, templ.rows);
+    std::vector<cv::Rect>& windows = ctx.workspace.rects;
+    windows.clear();
+    for(std::vector<cv::Rect>::iterator _d = dirty_rects.begin(); _d != dirty_rects.end(); _d++){
+        if((*_d & previous).area() > 0){
+            addStatistic(counters[STAT_DIRTY_FULL], 1);
+            return false;
+        }
+        cv::Rect window(_d->x - templ.cols + 1, _d->y - templ.rows + 1, _d->width + 2*(templ.cols - 1), _d->height + 2*(templ.rows - 1));
+        window &= region;
+        if(window.width >= templ.cols && window.height >= templ.rows){
+            windows.push_back(window);
+        }
+    }
+
+    bool lower = ( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED );
+    minVal = record.minVal;
+    maxVal = record.maxVal;
+    matchLoc = record.loc;
+    matchVal = record.val;
+    /// Windows are scored by the engine of the finest level of full matches, with which the previous match is rescored so that both compare
+    if(!windows.empty()){
+        cv::Mat res = ctx.workspace.buffer(ctx.workspace.window, cv::Size(1,1), CV_32FC1);
+        matchWorkspaceTemplate(ctx.ref_gray(previous), templ, res, match_method, ctx.workspace, false);
+        matchVal = res.at<float>(0,0);
+        minVal = std::min(minVal, matchVal);
+        maxVal = std::max(maxVal, matchVal);
+    }
+    double searched = 0;
+    for(std::vector<cv::Rect>::iterator _w = windows.begin(); _w != windows.end(); _w++){
+        cv::Mat res = ctx.workspace.buffer(ctx.workspace.window, _w->size() + cv::Size(1,1) - templ.size(), CV_32FC1);
+        matchWorkspaceTemplate(ctx.ref_gray(*_w), templ, res, match_method, ctx.workspace, false);
+        double windowMin; double windowMax; Point windowMinLoc; Point windowMaxLoc;
+        minMaxLoc( res, &windowMin, &windowMax, &windowMinLoc, &windowMaxLoc, Mat() );
+        minVal = std::min(minVal, windowMin);
+        maxVal = std::max(maxVal, windowMax);
+        double val = lower ? windowMin : windowMax;
+        Point loc = lower ? windowMinLoc : windowMaxLoc;
+        if(lower ? val < matchVal : val > matchVal){
+            matchVal = val;
+            matchLoc = Point(_w->x - region.x + loc.x, _w->y - region.y + loc.y);
+        }
+        searched += _w->area();
+    }
+    addStatistic(counters[STAT_DIRTY_INCREMENTAL], 1);
+    addStatistic(counters[STAT_DIRTY_SEARCHED], searched);
+    addStatistic(counters[STAT_DIRTY_REGION], region.area());
+    return true;
+}
+
+bool InspectorWidgetProcessor::matchExact(InspectorWidgetFrameContext& ctx, size_t index, const cv::Mat& frame, cv::Point& matchLoc){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    const cv::Mat& tpl = table.gray_templates[index];
+    int w = tpl.cols, h = tpl.rows;
+    int cols = frame.cols - w + 1;
+    int rows = frame.rows - h + 1;
+    if(w <= 0 || h <= 0 || cols <= 0 || rows <= 0){
+        return false;
+    }
+
+    /// Row hashes only depend on the template width, templates of the same width searching the same region share them
+    std::vector<uint64>& row_hashes = ctx.row_hashes;
+    if(ctx.row_hashes_analysis != ctx.analyses || ctx.row_hashes_width != w || ctx.row_hashes_data != frame.data || ctx.row_hashes_size != frame.size()){
+        uint64 row_power = hashPower(row_hash_base, w);
+        row_hashes.resize((size_t)cols*frame.rows);
+        for(int y = 0; y < frame.rows; y++){
+            const uchar* row = frame.ptr(y);
+            uint64* hashes = &row_hashes[(size_t)y*cols];
+            uint64 hash = 0;
+            for(int x = 0; x < w; x++){
+                hash = hash*row_hash_base + row[x];
+            }
+            hashes[0] = hash;
+            for(int x = 1; x < cols; x++){
+                hash = hash*row_hash_base - row[x-1]*row_power + row[x+w-1];
+                hashes[x] = hash;
+            }
+        }
+        ctx.row_hashes_analysis = ctx.analyses;
+        ctx.row_hashes_width = w;
+        ctx.row_hashes_data = frame.data;
+        ctx.row_hashes_size = frame.size();
+    }
+
+    /// Column hashes of h consecutive row hashes roll down the frame one row of positions at a time
+    uint64 target = table.exact_hashes[index];
+    uint64 column_power = hashPower(column_hash_base, h);
+    std::vector<uint64>& columns = ctx.column_hashes;
+    columns.assign(cols, 0);
+    for(int y = 0; y < h; y++){
+        const uint64* hashes = &row_hashes[(size_t)y*cols];
+        for(int x = 0; x < cols; x++){
+            columns[x] = columns[x]*column_hash_base + hashes[x];
+        }
+    }
+    for(int y = 0; y < rows; y++){
+        for(int x = 0; x < cols; x++){
+            if(columns[x] != target){
+                continue;
+            }
+            /// Hash collisions are ruled out by comparing the pixels
+            bool equal = true;
+            for(int j = 0; j < h && equal; j++){
+                equal = (memcmp(frame.ptr(y+j) + x, tpl.ptr(j), w) == 0);
+            }
+            if(equal){
+                matchLoc = cv::Point(x,y);
+                return true;
+            }
+        }
+        if(y + 1 < rows){
+            const uint64* leaving = &row_hashes[(size_t)y*cols];
+            const uint64* entering = &row_hashes[(size_t)(y+h)*cols];
+            for(int x = 0; x < cols; x++){
+                columns[x] = columns[x]*column_hash_base - leaving[x]*column_power + entering[x];
+            }
+        }
+    }
+    return false;
+}
+
+void InspectorWidgetProcessor::updateIntegrals(InspectorWidgetFrameContext& ctx, int level){
+    /// Sums and squared sums of the level are shared by all the templates that need them in this frame
+    if((int)ctx.integral_analyses.size() <= level){
+        ctx.integral_analyses.resize(level+1,-1);
+        ctx.ref_sums.resize(level+1);
+        ctx.ref_sqsums.resize(level+1);
+    }
+    if(ctx.integral_analyses[level] != ctx.analyses){
+        cv::integral(ctx.ref_pyramid[level], ctx.ref_sums[level], ctx.ref_sqsums[level], CV_64F);
+        ctx.integral_analyses[level] = ctx.analyses;
+    }
+}
+
+void InspectorWidgetProcessor::matchSpectrum(InspectorWidgetFrameContext& ctx, size_t index, cv::Mat& res){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    int level = table.fft_level[index];
+
+    /// Flat templates match everywhere with TM_CCOEFF_NORMED, as with cv::matchTemplate, without correlating them
+    if(match_method == TM_CCOEFF_NORMED){
+        const cv::Mat& tpl = table.gray_template_pyramids[index][level];
+        double n = (double)tpl.cols*tpl.rows;
+        double templ_sum = table.fft_template_sum[index];
+        if(std::sqrt(std::max(table.fft_template_sqsum[index] - templ_sum*templ_sum/n, 0.0)) < DBL_EPSILON){
+            res.setTo(cv::Scalar(1));
+            return;
+        }
+    }
+
+    /// The frame spectrum of the level is shared by all the templates correlated in this frame
+    if((int)ctx.spectrum_analyses.size() <= level){
+        ctx.spectrum_analyses.resize(level+1,-1);
+        ctx.ref_spectra.resize(level+1);
+    }
+    if(ctx.spectrum_analyses[level] != ctx.analyses){
+        const cv::Mat& ref = ctx.ref_pyramid[level];
+        ctx.fft_padded.create(table.fft_sizes[level], CV_32F);
+        ctx.fft_padded.setTo(cv::Scalar(0));
+        cv::Mat frame = ctx.fft_padded(cv::Rect(0, 0, ref.cols, ref.rows));
+        ref.convertTo(frame, CV_32F);
+        cv::dft(ctx.fft_padded, ctx.ref_spectra[level], 0, ref.rows);
+        ctx.spectrum_analyses[level] = ctx.analyses;
+    }
+
+    /// Correlation is the product with the conjugate template spectrum, the padding avoids wrapping for valid positions
+    cv::mulSpectrums(ctx.ref_spectra[level], table.template_spectra[index], ctx.fft_product, 0, true);
+    cv::idft(ctx.fft_product, ctx.fft_correlation, cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, res.rows);
+
+    /// Window sums turn the correlation into the score of the method, with the tolerances of cv::matchTemplate
+    /// Coefficient methods already correlate the zero-mean template
+    updateIntegrals(ctx, level);
+    const cv::Mat& tpl = table.gray_template_pyramids[index][level];
+    double n = (double)tpl.cols*tpl.rows;
+    double templ_sum = table.fft_template_sum[index];
+    double templ_sqsum = table.fft_template_sqsum[index];
+    bool normed = (match_method == TM_SQDIFF_NORMED || match_method == TM_CCORR_NORMED || match_method == TM_CCOEFF_NORMED);
+    bool coeff = (match_method == TM_CCOEFF || match_method == TM_CCOEFF_NORMED);
+    bool sqdiff = (match_method == TM_SQDIFF || match_method == TM_SQDIFF_NORMED);
+    double templ_norm = std::sqrt(std::max(coeff ? templ_sqsum - templ_sum*templ_sum/n : templ_sqsum, 0.0));
+    const cv::Mat& sums = ctx.ref_sums[level];
+    const cv::Mat& sqsums = ctx.ref_sqsums[level];
+    for(int y = 0; y < res.rows; y++){
+        const float* correlation = ctx.fft_correlation.ptr<float>(y);
+        float* scores = res.ptr<float>(y);
+        const double* s0 = sums.ptr<double>(y);
+        const double* s1 = sums.ptr<double>(y + tpl.rows);
+        const double* q0 = sqsums.ptr<double>(y);
+        const double* q1 = sqsums.ptr<double>(y + tpl.rows);
+        for(int x = 0; x < res.cols; x++){
+            double s = s1[x + tpl.cols] - s1[x] - s0[x + tpl.cols] + s0[x];
+            double q = q1[x + tpl.cols] - q1[x] - q0[x + tpl.cols] + q0[x];
+            double num = correlation[x];
+            if(sqdiff){
+                num = std::max(q - 2*num + templ_sqsum, 0.0);
+            }
+            if(normed){
+                double t = std::sqrt(std::max(coeff ? q - s*s/n : q, 0.0))*templ_norm;
+                if(std::fabs(num) < t){
+                    num /= t;
+                }
+                else if(std::fabs(num) < t*1.125){
+                    num = num > 0 ? 1 : -1;
+                }
+                else{
+                    num = (match_method != TM_SQDIFF_NORMED) ? 0 : 1;
+                }
+            }
+            scores[x] = (float)num;
+        }
+    }
+}
+
+void InspectorWidgetProcessor::prefilterWindows(InspectorWidgetFrameContext& ctx, size_t index, const cv::Mat& ref, int level, std::vector<cv::Rect>& windows){
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    windows.clear();
+    updateIntegrals(ctx, level);
+    cv::Size whole; cv::Point offset;
+    ref.locateROI(whole, offset);
+
+    const cv::Mat& tpl = table.gray_template_pyramids[index][level];
+    int result_cols = ref.cols - tpl.cols + 1;
+    int result_rows = ref.rows - tpl.rows + 1;
+    if(result_cols <= 0 || result_rows <= 0){
+        return;
+    }
+    double n = (double)tpl.cols*tpl.rows;
+    double mean = table.template_means[index][level];
+    double stddev = table.template_stddevs[index][level];
+    double contrast = table.prefilter_contrast[index];
+    double brightness = table.prefilter_brightness[index];
+
+    /// Flat windows score 0 with TM_CCOEFF_NORMED, other bounds are optional as the method ignores brightness and contrast
+    const cv::Mat& sums = ctx.ref_sums[level];
+    const cv::Mat& sqsums = ctx.ref_sqsums[level];
+    int block = table.prefilter_block_size;
+    double searched = 0;
+    /// Block of the non-flat window closest to the template brightness, searched if no block survives so that the score stays a real one
+    cv::Point closest(-1,-1);
+    double closest_distance = DBL_MAX;
+    for(int by = 0; by < result_rows; by += block){
+        int rows = std::min(block, result_rows - by);
+        int run = -1;
+        for(int bx = 0; bx < result_cols + block; bx += block){
+            bool survives = false;
+            for(int y = by; y < by + rows && !survives && bx < result_cols; y++){
+                const double* s0 = sums.ptr<double>(offset.y + y) + offset.x;
+                const double* s1 = sums.ptr<double>(offset.y + y + tpl.rows) + offset.x;
+                const double* q0 = sqsums.ptr<double>(offset.y + y) + offset.x;
+                const double* q1 = sqsums.ptr<double>(offset.y + y + tpl.rows) + offset.x;
+                for(int x = bx; x < std::min(bx + block, result_cols); x++){
+                    double s = s1[x + tpl.cols] - s1[x] - s0[x + tpl.cols] + s0[x];
+                    double q = q1[x + tpl.cols] - q1[x] - q0[x + tpl.cols] + q0[x];
+                    double deviation = n*q - s*s;
+                    if(deviation < 0.5){
+                        continue;
+                    }
+                    if(std::fabs(s/n - mean) < closest_distance){
+                        closest_distance = std::fabs(s/n - mean);
+                        closest = cv::Point(bx, by);
+                    }
+                    if(contrast > 0){
+                        double window_stddev = std::sqrt(deviation)/n;
+                        if(window_stddev*contrast < stddev || window_stddev > stddev*contrast){
+                            continue;
+                        }
+                    }
+                    if(std::fabs(s/n - mean) > brightness){
+                        continue;
+                    }
+                    survives = true;
+                    break;
+                }
+            }
+            if(survives && run < 0){
+                run = bx;
+            }
+            else if(!survives && run >= 0){
+                /// Runs of surviving blocks become windows, merged with the window above when they span the same columns
+                cv::Rect window(run, by, std::min(bx, result_cols) - run, rows);
+                if(!windows.empty() && windows.back().x == window.x && windows.back().width == window.width && windows.back().y + windows.back().height == window.y){
+                    windows.back().height += window.height;
+                }
+                else{
+                    windows.push_back(window);
+                }
+                searched += (double)window.width*window.height;
+                run = -1;
+            }
+        }
+    }
+    if(windows.empty() && closest.x >= 0){
+        cv::Rect window(closest.x, closest.y, std::min(block, result_cols - closest.x), std::min(block, result_rows - closest.y));
+        windows.push_back(window);
+        searched += (double)window.width*window.height;
+    }
+    std::vector<double*>& counters = table.template_statistics[index];
+    addStatistic(counters[STAT_PREFILTER_POSITIONS], (double)result_cols*result_rows);
+    addStatistic(counters[STAT_PREFILTER_SEARCHED], searched);
+}
+
+bool InspectorWidgetProcessor::framesAreIndependent(){
+    /// Tracking windows and learned glyphs carry state from the previously analyzed frame, which is not the previous frame out of order
+    InspectorWidgetAnnotationTable& table = annotation_table;
+    for(size_t _index = 0; _index < table.tracking.size(); _index++){
+        if(table.tracking[_index]){
+            std::cout << "Frames analyzed in order: template '" << template_list[_index] << "' is tracked" << std::endl;
+            return false;
+        }
+    }
+    for(size_t _index = 0; _index < table.text_annotation.size(); _index++){
+        if(table.text_glyphs[_index]){
+            std::cout << "Frames analyzed in order: text '" << table.annotation_names[table.text_annotation[_index]] << "' is read with learned glyphs" << std::endl;
+            return false;
+        }
+    }
+    /// Frames can be analyzed out of order only if no template depends on a value matched in a previous frame
+    for(std::vector<std::string>::iterator _n = template_list.begin(); _n != template_list.end(); _n++ ){
+        std::map<std::string,std::vector<std::string> >::iterator _deps = template_matching_dep_map.find(*_n);
+        if(_deps == template_matching_dep_map.end()) continue;
+        for(std::vector<std::string>::iterator _d = _deps->second.begin(); _d != _deps->second.end(); _d++){
+            if(log_val.find(*_d) != log_val.end()) continue;
+            if(std::find(template_list.begin(),_n,*_d) == _n){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool InspectorWidgetProcessor::computeComputerVisionPipeline(){
+
+    int workers = (int)getSetting("workers",cv::getNumberOfCPUs());
+    if(workers < 1){
+        return false;
+    }
+    int ring_size = (int)getSetting("queueSize",2*workers);
+    if(ring_size < workers + 1){
+        ring_size = workers + 1;
+    }
+
+    std::cout << "Pipeline with " << workers << " analysis worker(s) and " << ring_size << " frame slots" << std::endl;
+
+    int frames = this->video_frames;
+    std::vector<InspectorWidgetFrameSlot> slots(ring_size);
+    std::mutex pipeline_mutex;
+    std::condition_variable pipeline_condition;
+    bool stop = false;
+    std::string worker_error;
+    double decode_time = 0, write_time = 0;
+    std::vector<double> analysis_times(workers,0.0);
+
+    /// Worker contexts are prepared here since preparing inserts keys in the shared maps
+    std::vector<InspectorWidgetFrameContext> contexts(workers);
+    for(int w = 0; w < workers; w++){
+        prepareFrameContext(contexts[w]);
+    }
+
+    int cv_threads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    double frequency = getTickFrequency();
+    int64 pipeline_start = getTickCount();
+
+    std::thread decoder([&](){
+        cv::Mat previous;
+        for(int f = 0; f < frames; f++){
+            InspectorWidgetFrameSlot& slot = slots[f % ring_size];
+            {
+                std::unique_lock<std::mutex> lock(pipeline_mutex);
+                pipeline_condition.wait(lock,[&](){ return stop || slot.state == InspectorWidgetFrameSlot::EMPTY; });
+                if(stop) return;
+            }
+            int64 start = getTickCount();
+            cv::Mat decoded;
+            if(!cap.read(decoded) || decoded.empty()){
+                /// Without a previous frame to reuse, workers would get an empty image
+                if(previous.empty()){
+                    std::unique_lock<std::mutex> lock(pipeline_mutex);
+                    std::stringstream msg;
+                    msg << "Problem reading frame " << f << " of file " << videostem;
+                    worker_error = msg.str();
+                    stop = true;
+                    pipeline_condition.notify_all();
+                    return;
+                }
+                std::cerr << "Problem reading frame " << f << ", reusing the previous frame" << std::endl;
+                decoded = previous;
+            }
+            previous = decoded;
+            decode_time += (double)(getTickCount()-start)/frequency;
+            {
+                std::unique_lock<std::mutex> lock(pipeline_mutex);
+                slot.img = decoded;
+                slot.frame = f;
+                slot.state = InspectorWidgetFrameSlot::DECODED;
+            }
+            pipeline_condition.notify_all();
+        }
+    });
+
+    std::vector<std::thread> analyzers;
+    for(int w = 0; w < workers; w++){
+        analyzers.push_back(std::thread([&,w](){
+            InspectorWidgetFrameContext& ctx = contexts[w];
+            for(int f = w; f < frames; f += workers){
+                InspectorWidgetFrameSlot& slot = slots[f % ring_size];
+                {
+                    std::unique_lock<std::mutex> lock(pipeline_mutex);
+                    pipeline_condition.wait(lock,[&](){ return stop || (slot.state == InspectorWidgetFrameSlot::DECODED && slot.frame == f); });
+                    if(stop) return;
+                    ctx.img = slot.img;
+                }
+                try{
+                    analyzeFrame(ctx,f);
+                }
+                catch(std::exception& e){
+                    std::unique_lock<std::mutex> lock(pipeline_mutex);
+                    std::stringstream msg;
+                    msg << "Analysis of frame " << f << " failed: " << e.what();
+                    worker_error = msg.str();
+                    stop = true;
+                    pipeline_condition.notify_all();
+                    return;
+                }
+                analysis_times[w] += ctx.result.analysis_time;
+                {
+                    std::unique_lock<std::mutex> lock(pipeline_mutex);
+                    std::swap(slot.result,ctx.result);
+                    slot.img.release();
+                    slot.state = InspectorWidgetFrameSlot::ANALYZED;
+                }
+                pipeline_condition.notify_all();
+            }
+        }));
+    }
+
+    /// Results are committed in frame order from this thread
+    InspectorWidgetFrameResult result;
+    int committed = 0;
+    while(committed < frames){
+        if(!active){
+            std::unique_lock<std::mutex> lock(pipeline_mutex);
+            stop = true;
+            break;
+        }
+        InspectorWidgetFrameSlot& slot = slots[committed % ring_size];
+        {
+            std::unique_lock<std::mutex> lock(pipeline_mutex);
+            pipeline_condition.wait(lock,[&](){ return stop || (slot.state == InspectorWidgetFrameSlot::ANALYZED && slot.frame == committed); });
+            if(stop) break;
+            std::swap(result,slot.result);
+            slot.state = InspectorWidgetFrameSlot::EMPTY;
+        }
+        pipeline_condition.notify_all();
+
+        int64 start = getTickCount();
+        this->frame = committed;
+        this->status_progress = (float)committed/(float)frames;
+        commitFrameResult(result);
+        write_time += (double)(getTickCount()-start)/frequency;
+
+        std::cout << "Time taken=" << result.analysis_time << " for frame " << committed << " @ " << frames2tc(committed,fps) << std::endl;
+        committed++;
+    }
+    pipeline_condition.notify_all();
+
+    decoder.join();
+    for(std::vector<std::thread>::iterator _a = analyzers.begin(); _a != analyzers.end(); _a++){
+        _a->join();
+    }
+    cv::setNumThreads(cv_threads);
+
+    double pipeline_time = (double)(getTickCount()-pipeline_start)/frequency;
+    double analysis_time = 0;
+    for(std::vector<double>::iterator _t = analysis_times.begin(); _t != analysis_times.end(); _t++){
+        analysis_time += *_t;
+    }
+    std::cout << "Time taken=" << pipeline_time << " for " << committed << " frames (" << (pipeline_time > 0 ? committed/pipeline_time : 0) << " fps)" << std::endl;
+    std::cout << "Time taken=" << decode_time << " for decoding (" << (decode_time > 0 ? committed/decode_time : 0) << " fps)" << std::endl;
+    std::cout << "Time taken=" << analysis_time << " for analysis over " << workers << " worker(s) (" << (analysis_time > 0 ? workers*committed/analysis_time : 0) << " fps)" << std::endl;
+    std::cout << "Time taken=" << write_time << " for writing (" << (write_time > 0 ? committed/write_time : 0) << " fps)" << std::endl;
+
+    this->frame = committed;
+
+    if(!worker_error.empty()){
+        setStatusAndReturn(/*phase*/"process",/*error*/worker_error, /*success*/"");
+    }
+    else if(!active){
+        std::stringstream msg;
+        msg << "Abort requested for video file " << videostem << "), aborting";
+        setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
+    }
+    return true;
+}
+
+std::vector<bool> InspectorWidgetProcessor::templatePresence(InspectorWidgetFrameResult& result){
+    std::vector<bool> presence(result.template_val.size(),false);
+    for(size_t _index = 0; _index < presence.size(); _index++){
+        presence[_index] = result.template_processed[_index] && result.template_matched[_index] && result.template_val[_index] > _threshold;
+    }
+    return presence;
+}
+
+bool InspectorWidgetProcessor::computeComputerVisionBisection(){
+
+    int step = (int)getSetting("bisectionStep",0);
+    int frames = this->video_frames;
+    if(step < 2 || frames < 2){
+        return false;
+    }
+    /// Text can change while all templates keep their presence, so only template matching is sampled
+    if(!text_detect_list.empty()){
+        setStatusAndReturn(/*phase*/"init",/*error*/"Bisection sampling (bisectionStep setting) only applies to template matching, not to text detection, aborting", /*success*/"");
+        return true;
+    }
+
+    /// Frames between analyzed ones are not matched: their values are sampled, and presences toggling twice within a step are missed
+    std::cout << "Bisection sampling every " << step << " frames: x, y and values of frames between analyzed ones are those of the last analyzed frame,"
+              << " and templates appearing and disappearing within " << step << " frames are missed" << std::endl;
+
+    InspectorWidgetFrameContext& ctx = frame_context;
+    prepareFrameContext(ctx);
+
+    double frequency = getTickFrequency();
+    int64 bisection_start = getTickCount();
+    double decode_time = 0, analysis_time = 0, write_time = 0;
+    int position = 0, analyses = 0, committed = 0;
+    std::string error;
+
+    /// Analyzed frames not committed yet, frames in between take the result of the closest analyzed frame before them
+    std::map<int,InspectorWidgetFrameResult> analyzed;
+
+    auto analyze = [&](int f) -> bool {
+        int64 start = getTickCount();
+        cv::Mat decoded;
+        if(!seekFrame(cap,position,f,cap_seek) || !cap.read(decoded) || decoded.empty()){
+            if(ctx.img.empty()){
+                std::stringstream msg;
+                msg << "Problem reading frame " << f << " of file " << videostem;
+                error = msg.str();
+                return false;
+            }
+            std::cerr << "Problem reading frame " << f << ", reusing the previous frame" << std::endl;
+            decoded = ctx.img;
+            position = -1;
+        }
+        else{
+            position++;
+        }
+        ctx.img = decoded;
+        decode_time += (double)(getTickCount()-start)/frequency;
+        analyzeFrame(ctx,f);
+        analysis_time += ctx.result.analysis_time;
+        std::swap(analyzed[f],ctx.result);
+        analyses++;
+        return true;
+    };
+
+    auto commitUntil = [&](int end){
+        int64 start = getTickCount();
+        std::map<int,InspectorWidgetFrameResult>::iterator _source = analyzed.begin();
+        for(; committed < end; committed++){
+            std::map<int,InspectorWidgetFrameResult>::iterator _next = _source;
+            for(_next++; _next != analyzed.end() && _next->first <= committed; _next++){
+                _source = _next;
+            }
+            this->frame = committed;
+            this->status_progress = (float)committed/(float)frames;
+            if(_source->first == committed){
+                commitFrameResult(_source->second);
+            }
+            else{
+                writeTemplateMatches(_source->second, committed);
+            }
+        }
+        /// Only the last analyzed frame is kept to fill the next interval
+        analyzed.erase(analyzed.begin(),_source);
+        write_time += (double)(getTickCount()-start)/frequency;
+    };
+
+    /// Intervals whose bounds differ in presence of any template are split until the transition frame is found
+    std::vector<std::pair<int,int> > intervals;
+    int previous = 0;
+    if(analyze(previous)){
+        while(previous < frames-1 && active && error.empty()){
+            int sample = std::min(previous + step, frames-1);
+            if(!analyze(sample)) break;
+            intervals.push_back(std::make_pair(previous,sample));
+            while(!intervals.empty() && active){
+                std::pair<int,int> interval = intervals.back();
+                intervals.pop_back();
+                if(interval.second - interval.first < 2 || templatePresence(analyzed[interval.first]) == templatePresence(analyzed[interval.second])){
+                    continue;
+                }
+                int middle = (interval.first + interval.second)/2;
+                if(!analyze(middle)) break;
+                intervals.push_back(std::make_pair(middle,interval.second));
+                intervals.push_back(std::make_pair(interval.first,middle));
+            }
+            if(!error.empty() || !active) break;
+            commitUntil(sample);
+            std::cout << "Time taken=" << (double)(getTickCount()-bisection_start)/frequency << " until frame " << sample << " @ " << frames2tc(sample,fps) << std::endl;
+            previous = sample;
+        }
+        if(error.empty() && active){
+            commitUntil(frames);
+        }
+    }
+
+    double bisection_time = (double)(getTickCount()-bisection_start)/frequency;
+    std::cout << "Time taken=" << bisection_time << " for " << committed << " frames (" << (bisection_time > 0 ? committed/bisection_time : 0) << " fps)" << std::endl;
+    std::cout << "Time taken=" << decode_time << " for decoding and " << analysis_time << " for analyzing " << analyses << " frames, " << write_time << " for writing" << std::endl;
+    addStatistic("bisection/frames", committed);
+    addStatistic("bisection/analyzed frames", analyses);
+
+    this->frame = committed;
+
+    if(!error.empty()){
+        setStatusAndReturn(/*phase*/"process",/*error*/error, /*success*/"");
+    }
+    else if(!active){
+        std::stringstream msg;
+        msg << "Abort requested for video file " << videostem << "), aborting";
+        setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
+    }
+    return true;
+}
+
+bool InspectorWidgetProcessor::computeComputerVisionShards(){
+
+    int shards = (int)getSetting("shards",1);
+    int frames = this->video_frames;
+    if(shards < 2 || frames < shards){
+        return false;
+    }
+
+    /// Chunks start on keyframes so that each capture seeks without decoding frames of the previous chunk
+    /// Without an index, keyframes are unknown and the video is analyzed by a single capture instead
+    if(!cap_seek.keyframes){
+        std::cerr << "No keyframe index for " << videostem << ", analyzing without shards" << std::endl;
+        return false;
+    }
+    std::vector<int> bounds;
+    bounds.push_back(0);
+    for(int s = 1; s < shards; s++){
+        int bound = nearestKeyframe(cap_seek.keyframes.get(),(int)((long long)s*frames/shards));
+        if(bound > bounds.back()){
+            bounds.push_back(bound);
+        }
+    }
+    bounds.push_back(frames);
+    shards = bounds.size()-1;
+    if(shards < 2){
+        return false;
+    }
+
+    /// Results wait for the writer in a bounded queue per shard, shards ahead of the writer stop when theirs is full
+    struct Shard {
+        int begin,end,produced;
+        double decode_time,analysis_time;
+        std::deque<InspectorWidgetFrameResult> results;
+        std::vector<cv::Mat> debug_images;
+        InspectorWidgetFrameContext ctx;
+    };
+    size_t queue_size = (size_t)std::max(1,(int)getSetting("shardQueueSize",64));
+    std::vector<Shard> chunks(shards);
+    for(int s = 0; s < shards; s++){
+        chunks[s].begin = bounds[s];
+        chunks[s].end = bounds[s+1];
+        chunks[s].produced = 0;
+        chunks[s].decode_time = 0;
+        chunks[s].analysis_time = 0;
+        prepareFrameContext(chunks[s].ctx);
+        std::cout << "Shard " << s << " from frame " << chunks[s].begin << " to frame " << chunks[s].end-1 << std::endl;
+    }
+
+    std::string videopath = datapath + videostem + ".mp4";
+    std::mutex shard_mutex;
+    std::condition_variable shard_condition;
+    bool stop = false;
+    std::string shard_error;
+
+    int cv_threads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    double frequency = getTickFrequency();
+    int64 shards_start = getTickCount();
+
+    /// Each shard decodes and analyzes its chunk with its own capture
+    std::vector<std::thread> threads;
+    for(int s = 0; s < shards; s++){
+        threads.push_back(std::thread([&,s](){
+            Shard& shard = chunks[s];
+            std::stringstream msg;
+            InspectorWidgetLumaCapture capture;
+            capture.setLuma(cap.isLuma());
+            capture.open(videopath);
+            int position = 0;
+            if(!capture.isOpened() || (shard.begin > 0 && !seekFrame(capture,position,shard.begin,cap_seek))){
+                msg << "Problem seeking to frame " << shard.begin << " of file " << videopath;
+            }
+            cv::Mat previous;
+            for(int f = shard.begin; f < shard.end && msg.str().empty(); f++){
+                {
+                    std::unique_lock<std::mutex> lock(shard_mutex);
+                    if(stop) return;
+                }
+                int64 start = getTickCount();
+                cv::Mat decoded;
+                if(!capture.read(decoded) || decoded.empty()){
+                    if(previous.empty()){
+                        msg << "Problem reading frame " << f << " of file " << videopath;
+                        break;
+                    }
+                    std::cerr << "Problem reading frame " << f << ", reusing the previous frame" << std::endl;
+                    decoded = previous;
+                }
+                previous = decoded;
+                shard.decode_time += (double)(getTickCount()-start)/frequency;
+
+                shard.ctx.img = decoded;
+                try{
+                    analyzeFrame(shard.ctx,f);
+                }
+                catch(std::exception& e){
+                    msg << "Analysis of frame " << f << " failed: " << e.what();
+                    break;
+                }
+                shard.analysis_time += shard.ctx.result.analysis_time;
+
+                /// Only the debug images of the last frame of the chunk are kept, later frames overwrite the same files
+                std::vector<cv::Mat>& images = shard.ctx.result.debug_images;
+                shard.debug_images.resize(images.size());
+                for(size_t _image = 0; _image < images.size(); _image++ ){
+                    if(!images[_image].empty()) shard.debug_images[_image] = images[_image];
+                }
+                images.clear();
+                {
+                    std::unique_lock<std::mutex> lock(shard_mutex);
+                    shard_condition.wait(lock,[&](){ return stop || shard.results.size() < queue_size; });
+                    if(stop) return;
+                    shard.results.push_back(InspectorWidgetFrameResult());
+                    std::swap(shard.results.back(),shard.ctx.result);
+                    shard.produced++;
+                }
+                shard_condition.notify_all();
+            }
+            if(!msg.str().empty()){
+                std::unique_lock<std::mutex> lock(shard_mutex);
+                shard_error = msg.str();
+                stop = true;
+                shard_condition.notify_all();
+            }
+        }));
+    }
+
+    /// Shard results are merged in frame order from this thread
+    InspectorWidgetFrameResult result;
+    int committed = 0;
+    int s = 0;
+    while(committed < frames){
+        if(!active){
+            std::unique_lock<std::mutex> lock(shard_mutex);
+            stop = true;
+            break;
+        }
+        if(committed == chunks[s].end){
+            s++;
+        }
+        Shard& shard = chunks[s];
+        {
+            std::unique_lock<std::mutex> lock(shard_mutex);
+            shard_condition.wait(lock,[&](){ return stop || !shard.results.empty(); });
+            if(stop) break;
+            std::swap(result,shard.results.front());
+            shard.results.pop_front();
+        }
+        shard_condition.notify_all();
+        if(committed == shard.end-1){
+            result.debug_images = shard.debug_images;
+        }
+        this->frame = committed;
+        this->status_progress = (float)committed/(float)frames;
+        commitFrameResult(result);
+
+        std::cout << "Time taken=" << result.analysis_time << " for frame " << committed << " @ " << frames2tc(committed,fps) << std::endl;
+        committed++;
+    }
+    shard_condition.notify_all();
+
+    for(std::vector<std::thread>::iterator _t = threads.begin(); _t != threads.end(); _t++){
+        _t->join();
+    }
+    cv::setNumThreads(cv_threads);
+
+    double shards_time = (double)(getTickCount()-shards_start)/frequency;
+    for(int _s = 0; _s < shards; _s++){
+        std::cout << "Time taken=" << chunks[_s].decode_time << " for decoding and " << chunks[_s].analysis_time << " for analyzing " << chunks[_s].produced << " frames of shard " << _s << std::endl;
+    }
+    std::cout << "Time taken=" << shards_time << " for " << committed << " frames over " << shards << " shards (" << (shards_time > 0 ? committed/shards_time : 0) << " fps)" << std::endl;
+
+    this->frame = committed;
+
+    if(!shard_error.empty()){
+        setStatusAndReturn(/*phase*/"process",/*error*/shard_error, /*success*/"");
+    }
+    else if(!active){
+        std::stringstream msg;
+        msg << "Abort requested for video file " << videostem << "), aborting";
+        setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
+    }
+    return true;
+}
+
+void InspectorWidgetProcessor::addStatistic(std::string key, double value){
+    std::unique_lock<std::mutex> lock(statistics_mutex);
+    statistics[key] += value;
+}
 
-                if(with_gui){
-                    cv::Mat imz  = img.clone();
+double* InspectorWidgetProcessor::internStatistic(std::string key){
+    std::unique_lock<std::mutex> lock(statistics_mutex);
+    return &statistics[key];
+}
 
-                    //            cv::rectangle(
-                    //                        imz, cv::Point(_xs[0] , _ys[0]),
-                    //                    cv::Point(_xs[0]+_ws[0] , _ys[0]+_hs[0]),
-                    //                    cv::Scalar(0,255,0), 2
-                    //                    );
-                    //            cv::floodFill(
-                    //                        imz, cv::Point(_xs[0] , _ys[0]),
-                    //                    cv::Scalar(0), 0,
-                    //                    cv::Scalar(.1),
-                    //                    cv::Scalar(1.)
-                    //                    );
+void InspectorWidgetProcessor::addStatistic(double* statistic, double value){
+    std::unique_lock<std::mutex> lock(statistics_mutex);
+    *statistic += value;
+}
 
-                    //            cv::rectangle(
-                    //                        imz, cv::Point(_xs[1] , _ys[1]),
-                    //                    cv::Point(_xs[1]+_ws[1] , _ys[1]+_hs[1]),
-                    //                    cv::Scalar(255,0,0), 2
-                    //                    );
-                    //            cv::floodFill(
-                    //                        imz, cv::Point(_xs[1] , _ys[1]),
-                    //                    cv::Scalar(0), 0,
-                    //                    cv::Scalar(.1),
-                    //                    cv::Scalar(1.)
-                    //                    );
+double InspectorWidgetProcessor::getStatistic(std::string key){
+    std::unique_lock<std::mutex> lock(statistics_mutex);
+    std::map<std::string,double>::iterator _s = statistics.find(key);
+    return (_s != statistics.end()) ? _s->second : 0.0;
+}
 
-                    cv::rectangle(
-                                imz, rect,
-                                cv::Scalar(0,255,0), 2
-                                );
-                    cv::floodFill(
-                                imz, cv::Point(rect.x , rect.y),
-                                cv::Scalar(0), 0,
-                                cv::Scalar(.1),
-                                cv::Scalar(1.)
-                                );
+void InspectorWidgetProcessor::benchmarkMatchTemplate(std::string name, cv::Mat& frame, cv::Mat& templ, cv::Point matchLoc, double time){
+    /// Full search at the finest level, as done by MatchingMethod
+    cv::Mat reference;
+    int64 start = getTickCount();
+    MatchingMethod(frame, templ, reference, match_method);
+    double reference_time = (double)(getTickCount()-start)/getTickFrequency();
 
+    bool lower = ( match_method  == TM_SQDIFF || match_method == TM_SQDIFF_NORMED );
+    double minVal; double maxVal; Point minLoc; Point maxLoc;
+    minMaxLoc( reference, &minVal, &maxVal, &minLoc, &maxLoc, Mat() );
+    Point referenceLoc = lower ? minLoc : maxLoc;
+    double referenceVal = lower ? minVal : maxVal;
 
-                    imshow("orig", imz );
-                    waitKey(0);
-                }
+    addStatistic("matching/" + name + "/frames", 1);
+    addStatistic("matching/" + name + "/time", time);
+    addStatistic("matching/" + name + "/reference time", reference_time);
+    if(referenceVal > _threshold){
+        addStatistic("matching/" + name + "/matches", 1);
+        if(std::abs(matchLoc.x - referenceLoc.x) <= 1 && std::abs(matchLoc.y - referenceLoc.y) <= 1){
+            addStatistic("matching/" + name + "/recalled", 1);
+        }
+    }
+}
 
-                cv::Mat image = img(rect);
-                cvtColor( image, image, COLOR_RGB2GRAY);
+void InspectorWidgetProcessor::benchmarkNccKernel(std::string name, const cv::Mat& ref, const cv::Mat& templ){
+    /// Whole coarsest level matched by cv::matchTemplate, by the dispatched kernel and by the scalar kernel
+    if(templ.cols > ncc_kernel_max_size || templ.rows > ncc_kernel_max_size || ref.cols < templ.cols || ref.rows < templ.rows){
+        return;
+    }
+    cv::Mat sums, sqsums, reference, kernel, scalar;
+    int64 start = getTickCount();
+    cv::integral(ref, sums, sqsums, CV_64F);
+    double integral_time = (double)(getTickCount()-start)/getTickFrequency();
+
+    start = getTickCount();
+    cv::matchTemplate(ref, templ, reference, TM_CCOEFF_NORMED);
+    double reference_time = (double)(getTickCount()-start)/getTickFrequency();
+
+    start = getTickCount();
+    matchTemplateNcc(ref, templ, kernel, sums, sqsums, cv::Point(0,0), annotation_table.ncc_kernel_level);
+    double time = (double)(getTickCount()-start)/getTickFrequency();
+
+    start = getTickCount();
+    matchTemplateNcc(ref, templ, scalar, sums, sqsums, cv::Point(0,0), NCC_KERNEL_SCALAR);
+    double scalar_time = (double)(getTickCount()-start)/getTickFrequency();
+
+    addStatistic("kernel/" + name + "/frames", 1);
+    addStatistic("kernel/" + name + "/time", time);
+    addStatistic("kernel/" + name + "/scalar time", scalar_time);
+    addStatistic("kernel/" + name + "/reference time", reference_time);
+    addStatistic("kernel/" + name + "/integral time", integral_time);
+    addStatistic("kernel/" + name + "/error", cv::norm(reference, kernel, NORM_INF));
+}
+
+void InspectorWidgetProcessor::reportStatistics(){
+    const char* glyph_types[] = {"detectNumber","detectTime"};
+    for(int t = 0; t < 2; t++){
+        std::string type(glyph_types[t]);
+        double recognized = getStatistic("glyphs/" + type + "/recognized");
+        double fallbacks = getStatistic("glyphs/" + type + "/fallbacks");
+        if(recognized + fallbacks > 0){
+            std::cout << "Glyph recognition for " << type << ": " << recognized << " recognized and " << fallbacks << " Tesseract fallbacks";
+            double tesseract_time = getStatistic("glyphs/" + type + "/tesseract time");
+            if(recognized > 0 && tesseract_time > 0){
+                double time = getStatistic("glyphs/" + type + "/time");
+                std::cout << ", accuracy " << getStatistic("glyphs/" + type + "/agreed")/recognized
+                          << " and speedup " << (time > 0 ? tesseract_time/time : 0) << " against Tesseract";
+            }
+            std::cout << std::endl;
+        }
+    }
+    double workspace_allocations = getStatistic("workspace/allocations");
+    double overhead_frames = getStatistic("overhead/frames");
+    if(overhead_frames > 0 || workspace_allocations > 0){
+        std::cout << "Matching workspace buffers (other frame buffers not counted): " << getStatistic("workspace/reserved") << " allocated when reserved, " << workspace_allocations << " reallocated while matching" << std::endl;
+    }
+    if(overhead_frames > 0){
+        std::cout << "Per-frame overhead: " << 1000.0*getStatistic("overhead/time")/overhead_frames << "ms per frame resolving dependencies, regions and results, "
+                  << 1000.0*getStatistic("overhead/image time")/overhead_frames << "ms matching templates and extracting text regions" << std::endl;
+    }
+    double bisection_frames = getStatistic("bisection/frames");
+    if(bisection_frames > 0){
+        std::cout << "Bisection sampling: analyzed " << getStatistic("bisection/analyzed frames") << " of " << bisection_frames << " frames" << std::endl;
+    }
+    double keyframe_seeks = getStatistic("seek/keyframe seeks");
+    double backend_seeks = getStatistic("seek/backend seeks");
+    double skips = getStatistic("seek/skips");
+    double missed_seeks = getStatistic("seek/missed seeks");
+    if(keyframe_seeks > 0 || backend_seeks > 0 || skips > 0 || missed_seeks > 0){
+        std::cout << "Seeks: " << keyframe_seeks << " to keyframes, " << backend_seeks << " left to the capture backend, " << skips << " gaps decoded forward instead, " << missed_seeks << " missed and decoded from the first frame" << std::endl;
+        std::cout << "Seeks: " << getStatistic("seek/seek time") << "s seeking, " << getStatistic("seek/decode time") << "s decoding " << getStatistic("seek/decoded frames") << " skipped frames, estimated " << getStatistic("seek/estimated time saved") << "s saved by the cheaper choice" << std::endl;
+    }
+    double ocr_batches = getStatistic("ocr/batches");
+    if(ocr_batches > 0){
+        std::cout << "OCR batches: " << ocr_batches << " composites for " << getStatistic("ocr/batched regions") << " regions" << std::endl;
+    }
+    double frame_hits = getStatistic("frames/hits");
+    double frame_misses = getStatistic("frames/misses");
+    if(frame_hits + frame_misses > 0){
+        std::cout << "Decoded frame cache: " << frame_hits << " hits and " << frame_misses << " misses" << std::endl;
+    }
+    double ocr_hits = getStatistic("ocr/hits");
+    double ocr_misses = getStatistic("ocr/misses");
+    if(ocr_hits + ocr_misses > 0){
+        std::cout << "OCR cache: " << ocr_hits << " hits and " << ocr_misses << " misses (hit rate " << ocr_hits/(ocr_hits + ocr_misses) << ")" << std::endl;
+    }
+    for(std::vector<std::string>::iterator _n = template_list.begin(); _n != template_list.end(); _n++ ){
+        std::string _name = *_n;
+        double skipped = getStatistic("gating/" + _name + "/skipped");
+        double matched = getStatistic("gating/" + _name + "/matched");
+        if(skipped + matched > 0){
+            std::cout << "Frame-difference gating for '" << _name << "': skipped " << skipped << " of " << skipped + matched << " matches" << std::endl;
+        }
+        double hits = getStatistic("tracking/" + _name + "/hits");
+        double misses = getStatistic("tracking/" + _name + "/misses");
+        if(hits + misses > 0){
+            std::cout << "Tracking window for '" << _name << "': " << hits << " hits and " << misses << " misses (hit rate " << hits/(hits + misses) << ")" << std::endl;
+        }
+        double incremental = getStatistic("dirty/" + _name + "/incremental");
+        double full = getStatistic("dirty/" + _name + "/full");
+        if(incremental + full > 0){
+            double region = getStatistic("dirty/" + _name + "/region");
+            std::cout << "Dirty-rectangle matching for '" << _name << "': " << incremental << " incremental and " << full << " full matches, "
+                      << (region > 0 ? 100.0*getStatistic("dirty/" + _name + "/searched")/region : 0) << "% of the region searched" << std::endl;
+        }
+        double coarse = getStatistic("scale/" + _name + "/coarse");
+        if(coarse > 0){
+            std::cout << "Reduced resolution analysis for '" << _name << "': " << getStatistic("scale/" + _name + "/refined") << " of " << coarse << " coarse matches refined at full resolution" << std::endl;
+        }
+        double positions = getStatistic("prefilter/" + _name + "/positions");
+        double prefilter_skipped = getStatistic("prefilter/" + _name + "/skipped");
+        if(positions > 0){
+            std::cout << "Statistics prefilter for '" << _name << "': " << 100.0*getStatistic("prefilter/" + _name + "/searched")/positions
+                      << "% of the coarsest positions searched, " << prefilter_skipped << " matches skipped" << std::endl;
+        }
+        double exact_hits = getStatistic("exact/" + _name + "/hits");
+        double exact_fallbacks = getStatistic("exact/" + _name + "/fallbacks");
+        if(exact_hits + exact_fallbacks > 0){
+            std::cout << "Exact matching for '" << _name << "': " << exact_hits << " exact hits and " << exact_fallbacks << " fallbacks to " << match_method << " matching" << std::endl;
+        }
+        double fft_matches = getStatistic("fft/" + _name + "/matches");
+        if(fft_matches > 0){
+            std::cout << "Frequency-domain correlation for '" << _name << "': " << fft_matches << " coarse matches with the cached template spectrum" << std::endl;
+        }
+        double kernel_frames = getStatistic("kernel/" + _name + "/frames");
+        if(kernel_frames > 0){
+            double time = getStatistic("kernel/" + _name + "/time");
+            double reference_time = getStatistic("kernel/" + _name + "/reference time");
+            std::cout << "NCC kernel benchmark for '" << _name << "' (" << gray_templates[_name].cols << "x" << gray_templates[_name].rows << " at its coarsest level) over " << kernel_frames << " frames: "
+                      << nccKernelName(annotation_table.ncc_kernel_level) << "=" << time/kernel_frames
+                      << " scalar=" << getStatistic("kernel/" + _name + "/scalar time")/kernel_frames
+                      << " cv::matchTemplate=" << reference_time/kernel_frames
+                      << " integral=" << getStatistic("kernel/" + _name + "/integral time")/kernel_frames
+                      << " speedup=" << (time > 0 ? reference_time/time : 0)
+                      << " error=" << getStatistic("kernel/" + _name + "/error")/kernel_frames << std::endl;
+        }
+        double frames = getStatistic("matching/" + _name + "/frames");
+        if(frames > 0){
+            double time = getStatistic("matching/" + _name + "/time");
+            double reference_time = getStatistic("matching/" + _name + "/reference time");
+            double matches = getStatistic("matching/" + _name + "/matches");
+            double recalled = getStatistic("matching/" + _name + "/recalled");
+            std::cout << "Matching benchmark for '" << _name << "' over " << frames << " frames: pruned=" << time/frames
+                      << " full=" << reference_time/frames << " speedup=" << (time > 0 ? reference_time/time : 0)
+                      << " recall=" << (matches > 0 ? recalled/matches : 1.0) << " (" << recalled << "/" << matches << ")" << std::endl;
+        }
+    }
+}
 
+float InspectorWidgetProcessor::getSetting(std::string key, float value, std::string name){
+    /// Per-annotation settings override global settings, lookups never insert so that threads can share them
+    if(!name.empty()){
+        std::map<std::string,std::map<std::string,std::string> >::const_iterator _a = annotation_settings.find(name);
+        if(_a != annotation_settings.end()){
+            std::map<std::string,std::string>::const_iterator _s = _a->second.find(key);
+            if(_s != _a->second.end()){
+                return atof(_s->second.c_str());
+            }
+        }
+    }
+    std::map<std::string,std::string>::const_iterator _s = settings.find(key);
+    if(_s != settings.end()){
+        return atof(_s->second.c_str());
+    }
+    return value;
+}
 
-                if(!image.empty()){
-                    //namedWindow( text_window, WINDOW_KEEPRATIO | WINDOW_NORMAL );
-                    if(with_gui){
-                        imshow(text_window, image );
-                        waitKey(0);
-                    }
+tesseract::TessBaseAPI* InspectorWidgetProcessor::acquireOcrEngine(std::string type){
+    tesseract::TessBaseAPI* engine = 0;
+    {
+        std::unique_lock<std::mutex> lock(ocr_engines_mutex);
+        std::vector<tesseract::TessBaseAPI*>& engines = ocr_engines[type];
+        if(!engines.empty()){
+            engine = engines.back();
+            engines.pop_back();
+        }
+    }
+    if(engine){
+        /// Engines do not learn from previous images, like a freshly initialized one
+        engine->ClearAdaptiveClassifier();
+        return engine;
+    }
 
+    std::string lang("eng");
+    //std::cout << "Using language " << lang << std::endl;
 
-                    if( text_detect_type[_name] == "detectTime" || text_detect_type[_name] == "detectText"){
-                        //CF threshold test
-                        /* 0: Binary
-                     1: Binary Inverted
-                     2: Threshold Truncated
-                     3: Threshold to Zero
-                     4: Threshold to Zero Inverted
-                   */
+    engine = new tesseract::TessBaseAPI();
+    engine->Init(NULL, lang.c_str() );
 
-                        int threshold_type = 0;
-                        double max_BINARY_value = 255;
-                        double threshold_value = 0.5*255;
+    /// Batch engines read several lines from composite images
+    bool batch = (type.compare(0,6,"batch:") == 0);
+    if(batch){
+        type = type.substr(6);
+    }
 
-                        threshold( image, image, threshold_value, max_BINARY_value,threshold_type );
-                    }
+    if( type == "detectNumber"){
+        //CF digit detection test
+        engine->SetPageSegMode(tesseract::PSM_SINGLE_LINE);
+        bool digitsonly = engine->SetVariable("tessedit_char_whitelist", "0123456789");
+        //std::cout << "digitsonly "<< digitsonly << std::endl;
+    }
+    else if( type == "detectTime"){
+        //CF digit detection test
+        engine->SetPageSegMode(tesseract::PSM_SINGLE_LINE);
+        bool digitsonly = engine->SetVariable("tessedit_char_whitelist", "0123456789:-.");
+        //std::cout << "digitsonly "<< digitsonly << std::endl;
+    }
+    else if( type == "detectText"){
+        engine->SetPageSegMode(tesseract::PSM_SINGLE_LINE);
+        bool alphasonly = engine->SetVariable("tessedit_char_whitelist", "abcdefghijklmnopqrstuvxyz");
+        //std::cout << "alphasonly "<< alphasonly << std::endl;
+    }
 
-                    std::string imagefile = this->datapath + this->videostem + "-detecttext.png";
-                    cv::imwrite(imagefile.c_str(),image);
+    //engine->SetPageSegMode(tesseract::PSM_AUTO_ONLY);
 
-                    /*std::stringstream patchpath;
-                patchpath << datapath << videostem << "-patch-" << csv_frame << ".png";
-                cv::imwrite(patchpath.str(),image);*/
+    if(batch){
+        engine->SetPageSegMode(tesseract::PSM_SINGLE_BLOCK);
+    }
 
-                    std::string lang("eng");
-                    //std::cout << "Using language " << lang << std::endl;
+    return engine;
+}
 
-                    /* Use Tesseract to try to decipher our image */
-                    tesseract::TessBaseAPI tesseract_api;
+void InspectorWidgetProcessor::releaseOcrEngine(std::string type, tesseract::TessBaseAPI* engine){
+    engine->Clear();
+    std::unique_lock<std::mutex> lock(ocr_engines_mutex);
+    ocr_engines[type].push_back(engine);
+}
 
-                    tesseract_api.Init(NULL, lang.c_str() );
+uint64 InspectorWidgetProcessor::hashOcrImage(std::string type, const cv::Mat& image){
+    /// FNV-1a over the OCR type, the image size and the pixel rows
+    uint64 hash = 14695981039346656037ULL;
+    const uint64 prime = 1099511628211ULL;
+    for(std::string::iterator _c = type.begin(); _c != type.end(); _c++){
+        hash = (hash ^ (uchar)*_c) * prime;
+    }
+    int header[3] = {image.rows, image.cols, image.type()};
+    const uchar* bytes = (const uchar*)header;
+    for(size_t i = 0; i < sizeof(header); i++){
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    size_t row_size = image.cols*image.elemSize();
+    for(int y = 0; y < image.rows; y++){
+        const uchar* row = image.ptr(y);
+        for(size_t x = 0; x < row_size; x++){
+            hash = (hash ^ row[x]) * prime;
+        }
+    }
+    return hash;
+}
 
-                    if( text_detect_type[_name] == "detectNumber"){
-                        //CF digit detection test
-                        tesseract_api.SetPageSegMode(tesseract::PSM_SINGLE_LINE);
-                        bool digitsonly = tesseract_api.SetVariable("tessedit_char_whitelist", "0123456789");
-                        //std::cout << "digitsonly "<< digitsonly << std::endl;
-                    }
-                    else if( text_detect_type[_name] == "detectTime"){
-                        //CF digit detection test
-                        tesseract_api.SetPageSegMode(tesseract::PSM_SINGLE_LINE);
-                        bool digitsonly = tesseract_api.SetVariable("tessedit_char_whitelist", "0123456789:-.");
-                        //std::cout << "digitsonly "<< digitsonly << std::endl;
-                    }
-                    else if( text_detect_type[_name] == "detectText"){
-                        tesseract_api.SetPageSegMode(tesseract::PSM_SINGLE_LINE);
-                        bool alphasonly = tesseract_api.SetVariable("tessedit_char_whitelist", "abcdefghijklmnopqrstuvxyz");
-                        //std::cout << "alphasonly "<< alphasonly << std::endl;
-                    }
+bool InspectorWidgetProcessor::lookupOcrCache(std::string type, const cv::Mat& image, std::string& text){
+    if(ocr_cache_size <= 0){
+        return false;
+    }
+    uint64 hash = hashOcrImage(type,image);
+    std::unique_lock<std::mutex> lock(ocr_cache_mutex);
+    std::map<uint64,std::list<InspectorWidgetOcrCacheEntry>::iterator>::iterator _i = ocr_cache_index.find(hash);
+    bool hit = false;
+    if(_i != ocr_cache_index.end()){
+        /// Pixels are compared too so that hash collisions are misses
+        const cv::Mat& cached = _i->second->image;
+        hit = _i->second->type == type && cached.size() == image.size() && cached.type() == image.type();
+        size_t row_size = image.cols*image.elemSize();
+        for(int y = 0; hit && y < image.rows; y++){
+            hit = memcmp(cached.ptr(y), image.ptr(y), row_size) == 0;
+        }
+        if(hit){
+            text = _i->second->text;
+            ocr_cache.splice(ocr_cache.begin(), ocr_cache, _i->second);
+        }
+    }
+    lock.unlock();
+    addStatistic(run_statistics[hit ? STAT_OCR_HITS : STAT_OCR_MISSES], 1);
+    return hit;
+}
 
-                    //tesseract_api.SetPageSegMode(tesseract::PSM_AUTO_ONLY);
+void InspectorWidgetProcessor::storeOcrCache(std::string type, const cv::Mat& image, std::string text){
+    int capacity = ocr_cache_size;
+    if(capacity <= 0){
+        return;
+    }
+    InspectorWidgetOcrCacheEntry entry;
+    entry.hash = hashOcrImage(type,image);
+    entry.type = type;
+    entry.image = image.clone();
+    entry.text = text;
 
-                    tesseract_api.SetImage((uchar*) image.data, image.cols, image.rows, 1, image.cols);
+    std::unique_lock<std::mutex> lock(ocr_cache_mutex);
+    std::map<uint64,std::list<InspectorWidgetOcrCacheEntry>::iterator>::iterator _i = ocr_cache_index.find(entry.hash);
+    if(_i != ocr_cache_index.end()){
+        ocr_cache.erase(_i->second);
+    }
+    ocr_cache.push_front(entry);
+    ocr_cache_index[entry.hash] = ocr_cache.begin();
+    while((int)ocr_cache.size() > capacity){
+        ocr_cache_index.erase(ocr_cache.back().hash);
+        ocr_cache.pop_back();
+    }
+}
 
+bool InspectorWidgetProcessor::loadOcrCache(std::string path){
+    std::ifstream cache(path.c_str(), std::ios::binary | std::ios::ate);
+    if(!cache.is_open()){
+        return false;
+    }
+    int64 filesize = (int64)cache.tellg();
+    cache.seekg(0);
+    char magic[4];
+    int count = 0;
+    cache.read(magic,4);
+    cache.read((char*)&count,sizeof(count));
+    if(!cache || std::string(magic,4) != "IWOC" || count < 0){
+        std::cerr << "OCR cache " << path << " is not valid, ignoring" << std::endl;
+        return false;
+    }
+    int capacity = ocr_cache_size;
+    int discarded = 0;
+    std::unique_lock<std::mutex> lock(ocr_cache_mutex);
+    try{
+        for(int e = 0; e < count; e++){
+            InspectorWidgetOcrCacheEntry entry;
+            int header[5];
+            cache.read((char*)&entry.hash,sizeof(entry.hash));
+            cache.read((char*)header,sizeof(header));
+            /// Only thresholded regions are cached, and lengths are bounded by what is left of the file before anything is allocated
+            int64 remaining = filesize - (int64)cache.tellg();
+            if(!cache || header[0] < 0 || header[1] <= 0 || header[2] <= 0 || header[3] != CV_8UC1 || header[4] < 0
+                    || (int64)header[0] + (int64)header[1]*header[2] + header[4] > remaining){
+                discarded += count - e;
+                break;
+            }
+            entry.type.resize(header[0]);
+            cache.read(&entry.type[0],header[0]);
+            entry.image.create(header[1],header[2],CV_8UC1);
+            cache.read((char*)entry.image.data,entry.image.total());
+            entry.text.resize(header[4]);
+            cache.read(&entry.text[0],header[4]);
+            if(!cache){
+                discarded += count - e;
+                break;
+            }
+            /// Entries whose pixels do not match their hash would never be hit
+            if(entry.hash != hashOcrImage(entry.type,entry.image)){
+                discarded++;
+                continue;
+            }
+            if(ocr_cache_index.find(entry.hash) == ocr_cache_index.end()){
+                ocr_cache.push_back(entry);
+                ocr_cache_index[entry.hash] = --ocr_cache.end();
+            }
+        }
+    }
+    catch(std::exception& e){
+        std::cerr << "OCR cache " << path << " could not be read: " << e.what() << std::endl;
+    }
+    if(discarded > 0){
+        std::cerr << "Discarded " << discarded << " invalid entries of OCR cache " << path << std::endl;
+    }
+    /// Entries are kept most recent first, the oldest beyond the capacity are dropped
+    while((int)ocr_cache.size() > std::max(0,capacity)){
+        ocr_cache_index.erase(ocr_cache.back().hash);
+        ocr_cache.pop_back();
+    }
+    std::cout << "Loaded " << ocr_cache.size() << " OCR cache entries from " << path << std::endl;
+    return true;
+}
 
-                    text = string(tesseract_api.GetUTF8Text());
+bool InspectorWidgetProcessor::saveOcrCache(std::string path){
+    std::ofstream cache(path.c_str(), std::ios::binary);
+    if(!cache.is_open()){
+        std::cerr << "Could not write OCR cache " << path << std::endl;
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(ocr_cache_mutex);
+    int count = ocr_cache.size();
+    cache.write("IWOC",4);
+    cache.write((const char*)&count,sizeof(count));
+    for(std::list<InspectorWidgetOcrCacheEntry>::iterator _e = ocr_cache.begin(); _e != ocr_cache.end(); _e++){
+        cv::Mat image = _e->image.isContinuous() ? _e->image : _e->image.clone();
+        int header[5] = {(int)_e->type.size(), image.rows, image.cols, image.type(), (int)_e->text.size()};
+        cache.write((const char*)&_e->hash,sizeof(_e->hash));
+        cache.write((const char*)header,sizeof(header));
+        cache.write(_e->type.data(),_e->type.size());
+        cache.write((const char*)image.data,image.total()*image.elemSize());
+        cache.write(_e->text.data(),_e->text.size());
+    }
+    return true;
+}
 
-                    //std::cout << "Text: " << text << std::endl;
+std::shared_ptr<const InspectorWidgetKeyframeIndex> InspectorWidgetProcessor::indexKeyframes(std::string videopath, int frames){
+    /// Indexes are never modified once published, captures keep the one of their video while others are loaded
+    std::unique_lock<std::mutex> lock(keyframe_indexes_mutex);
+    std::map<std::string,std::shared_ptr<const InspectorWidgetKeyframeIndex> >::iterator _i = keyframe_indexes.find(videopath);
+    if(_i != keyframe_indexes.end()){
+        return _i->second;
+    }
+    std::shared_ptr<const InspectorWidgetKeyframeIndex> indexed;
+    if(getSetting("keyframeIndex",1) <= 0){
+        return indexed;
+    }
 
-                    /* Split the string by whitespace */
-                    vector<string> splitted;
-                    istringstream iss( text );
-                    copy( istream_iterator<string>(iss), istream_iterator<string>(), back_inserter( splitted ) );
+    std::ifstream video(videopath.c_str(), std::ios::binary | std::ios::ate);
+    if(!video.is_open()){
+        return indexed;
+    }
+    int64 videosize = (int64)video.tellg();
+    video.close();
 
-                    int n_words = splitted.size();
-                    std::cout << n_words << " word(s)" << std::endl;
+    /// The index is rebuilt when the sidecar is missing or was built for another version of the video
+    std::shared_ptr<InspectorWidgetKeyframeIndex> index = std::make_shared<InspectorWidgetKeyframeIndex>();
+    std::string indexpath = videopath.substr(0,videopath.find_last_of('.')) + "-keyframes.index";
+    if(!loadKeyframeIndex(indexpath,videosize,frames,*index)){
+        *index = InspectorWidgetKeyframeIndex();
+        if(!buildKeyframeIndex(videopath,*index)){
+            keyframe_indexes[videopath] = indexed;
+            return indexed;
+        }
+        saveKeyframeIndex(indexpath,videosize,*index);
+    }
+    indexed = index;
+    keyframe_indexes[videopath] = indexed;
+    return indexed;
+}
 
-                    std::cout << "Detected text: '" << text << "'" << std::endl;
+bool InspectorWidgetProcessor::buildKeyframeIndex(std::string videopath, InspectorWidgetKeyframeIndex& index){
+#ifdef HAVE_FFMPEG
+    int64 start = getTickCount();
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58,9,100)
+    av_register_all();
+#endif
+    AVFormatContext* format = 0;
+    if(avformat_open_input(&format, videopath.c_str(), 0, 0) < 0){
+        std::cerr << "Could not index keyframes of " << videopath << std::endl;
+        return false;
+    }
+    int stream = -1;
+    if(avformat_find_stream_info(format, 0) >= 0){
+        stream = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, 0, 0);
+    }
+    if(stream < 0){
+        std::cerr << "Could not find a video stream to index in " << videopath << std::endl;
+        avformat_close_input(&format);
+        return false;
+    }
 
-                    if(text.empty())
-                        text = " ";
+    /// Packets are only demuxed in decode order, keyframes are then ordered by presentation time
+    /// Frame positions are derived from presentation timestamps like the capture does
+    AVStream* video = format->streams[stream];
+    double time_base = av_q2d(video->time_base);
+    double rate = av_q2d(av_guess_frame_rate(format, video, 0));
+    int64_t first = (video->start_time == AV_NOPTS_VALUE) ? 0 : video->start_time;
+    std::map<int,double> keyframes;
+    AVPacket* packet = av_packet_alloc();
+    while(av_read_frame(format, packet) >= 0){
+        if(packet->stream_index == stream && (packet->flags & AV_PKT_FLAG_KEY)){
+            int64_t timestamp = (packet->pts != AV_NOPTS_VALUE) ? packet->pts : packet->dts;
+            if(timestamp != AV_NOPTS_VALUE && timestamp >= first){
+                double time = (timestamp - first) * time_base;
+                keyframes.insert(std::make_pair((int)floor(time * rate + 0.5), 1000.0 * time));
+            }
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    avformat_close_input(&format);
 
-                    text.erase (std::remove(text.begin(), text.end(), '\n'), text.end());
-                    text.erase (std::remove(text.begin(), text.end(), ','), text.end());
+    for(std::map<int,double>::iterator _k = keyframes.begin(); _k != keyframes.end(); _k++){
+        index.frames.push_back(_k->first);
+        index.times.push_back(_k->second);
+    }
+    std::cout << "Indexed " << index.frames.size() << " keyframes of " << videopath << " in " << (double)(getTickCount()-start)/getTickFrequency() << "s" << std::endl;
+    return !index.frames.empty();
+#else
+    return false;
+#endif
+}
 
-                    if( text_detect_type[_name] == "detectNumber"){
-                        if(n_words!=1){
-                            text = " ";
-                        }
-                        else{
-                            text = splitted[0];
-                        }
-                    }
-                    //                else if( text_detect_type[_name] == "detectTime"){
+bool InspectorWidgetProcessor::loadKeyframeIndex(std::string path, int64 videosize, int frames, InspectorWidgetKeyframeIndex& index){
+    std::ifstream sidecar(path.c_str(), std::ios::binary | std::ios::ate);
+    if(!sidecar.is_open()){
+        return false;
+    }
+    int64 filesize = (int64)sidecar.tellg();
+    sidecar.seekg(0);
+    char magic[4];
+    int64 size = 0;
+    int count = 0;
+    sidecar.read(magic,4);
+    sidecar.read((char*)&size,sizeof(size));
+    sidecar.read((char*)&count,sizeof(count));
+    /// Counts are bounded by the frames of the video and by what is left of the file before anything is allocated
+    int64 remaining = filesize - (int64)(4 + sizeof(size) + sizeof(count));
+    if(!sidecar || std::string(magic,4) != "IWKT" || size != videosize || count <= 0
+            || (frames > 0 && count > frames) || (int64)count*(int64)(sizeof(int)+sizeof(double)) != remaining){
+        std::cerr << "Keyframe index " << path << " is outdated or not valid, rebuilding" << std::endl;
+        return false;
+    }
+    index.frames.resize(count);
+    index.times.resize(count);
+    sidecar.read((char*)&index.frames[0],count*sizeof(int));
+    sidecar.read((char*)&index.times[0],count*sizeof(double));
+    bool valid = (bool)sidecar && index.frames.front() >= 0 && index.times.front() >= 0;
+    for(int k = 1; k < count && valid; k++){
+        valid = index.frames[k] > index.frames[k-1] && index.times[k] > index.times[k-1];
+    }
+    if(!valid){
+        std::cerr << "Keyframe index " << path << " is not sorted, rebuilding" << std::endl;
+        index.frames.clear();
+        index.times.clear();
+        return false;
+    }
+    std::cout << "Loaded " << index.frames.size() << " keyframes from " << path << std::endl;
+    return true;
+}
 
-                    //                }
+bool InspectorWidgetProcessor::saveKeyframeIndex(std::string path, int64 videosize, const InspectorWidgetKeyframeIndex& index){
+    std::ofstream sidecar(path.c_str(), std::ios::binary);
+    if(!sidecar.is_open()){
+        std::cerr << "Could not write keyframe index " << path << std::endl;
+        return false;
+    }
+    int count = index.frames.size();
+    sidecar.write("IWKT",4);
+    sidecar.write((const char*)&videosize,sizeof(videosize));
+    sidecar.write((const char*)&count,sizeof(count));
+    sidecar.write((const char*)&index.frames[0],count*sizeof(int));
+    sidecar.write((const char*)&index.times[0],count*sizeof(double));
+    return true;
+}
 
-                    std::cout << "Processed text: '" << text << "'" << std::endl;
-                    x = rect.x;
-                    y = rect.y;
+int InspectorWidgetProcessor::nearestKeyframe(const InspectorWidgetKeyframeIndex* keyframes, int frame){
+    if(!keyframes){
+        return frame;
+    }
+    std::vector<int>::const_iterator _k = std::upper_bound(keyframes->frames.begin(), keyframes->frames.end(), frame);
+    return (_k == keyframes->frames.begin()) ? 0 : *(_k-1);
+}
 
+bool InspectorWidgetProcessor::seekFrame(cv::VideoCapture& capture, int& position, int target, InspectorWidgetSeekState& state){
+    if(target == position){
+        return true;
+    }
+    double frequency = getTickFrequency();
 
+    /// A seek costs its own latency plus decoding from the nearest keyframe, skipping costs decoding every frame of the gap
+    const InspectorWidgetKeyframeIndex* keyframes = state.keyframes.get();
+    int keyframe = nearestKeyframe(keyframes,target);
+    /// Captures in an unknown position after a failed read are always seeked
+    bool seek = (target < position || position < 0);
+    double seek_time = 0, grab_time = 0;
+    if(!seek && (!keyframes || keyframe > position)){
+        std::unique_lock<std::mutex> lock(seek_cost_mutex);
+        /// Before measurements, a seek is assumed to cost as much as decoding a group of pictures
+        double grab = state.grab_samples > 0 ? state.grab_cost : 1;
+        int gop = (keyframes && keyframes->frames.size() > 1) ? (keyframes->frames.back()-keyframes->frames.front())/(keyframes->frames.size()-1) : 12;
+        double latency = state.seek_samples > 0 && state.grab_samples > 0 ? state.seek_cost : grab * (seek_latency >= 0 ? seek_latency : gop);
+        grab_time = (target - position) * grab;
+        seek_time = latency + (target - keyframe) * grab;
+        bool adaptive = adaptive_seek;
+        seek = adaptive ? (seek_time < grab_time) : (!keyframes || keyframe > position);
+        if(adaptive && state.grab_samples > 0){
+            addStatistic(run_statistics[STAT_SEEK_SAVED], std::fabs(grab_time - seek_time));
+        }
+    }
+
+    if(seek){
+        int64 start = getTickCount();
+        /// Keyframes are seeked by presentation time, the capture then reports the frame it actually landed on
+        /// Seeks landing after the target, as presentation times are rounded, are retried from the previous keyframes
+        int landed = -1;
+        bool first = true;
+        if(keyframes){
+            std::vector<int>::const_iterator _k = std::upper_bound(keyframes->frames.begin(), keyframes->frames.end(), target);
+            first = (_k == keyframes->frames.begin());
+            while(_k != keyframes->frames.begin() && landed < 0){
+                _k--;
+                if(capture.set(CAP_PROP_POS_MSEC,keyframes->times[_k-keyframes->frames.begin()])){
+                    landed = (int)capture.get(CAP_PROP_POS_FRAMES);
+                }
+                if(landed < 0 || landed > target){
+                    std::cerr << "Seek to keyframe " << *_k << " for frame " << target << " landed on frame " << landed << ", retrying from the previous keyframe" << std::endl;
+                    addStatistic(run_statistics[STAT_SEEK_MISSED], 1);
+                    landed = -1;
                 }
             }
+        }
+        else{
+            first = false;
+            if(capture.set(CAP_PROP_POS_FRAMES,target)){
+                landed = (int)capture.get(CAP_PROP_POS_FRAMES);
+            }
+            if(landed < 0 || landed > target){
+                std::cerr << "Seek to frame " << target << " landed on frame " << landed << std::endl;
+                addStatistic(run_statistics[STAT_SEEK_MISSED], 1);
+                landed = -1;
+            }
+        }
+        double time = (double)(getTickCount()-start)/frequency;
+        if(landed < 0){
+            /// Frames before the first keyframe, and as a last resort missed seeks, decode forward from the first frame
+            if(!first){
+                std::cerr << "Decoding frame " << target << " forward from the first frame" << std::endl;
+            }
+            if(!capture.set(CAP_PROP_POS_FRAMES,0) || (int)capture.get(CAP_PROP_POS_FRAMES) != 0){
+                position = -1;
+                return false;
+            }
+            landed = 0;
+        }
+        else{
+            addStatistic(run_statistics[keyframes ? STAT_SEEK_KEYFRAME : STAT_SEEK_BACKEND], 1);
+            addStatistic(run_statistics[STAT_SEEK_TIME], time);
+            std::unique_lock<std::mutex> lock(seek_cost_mutex);
+            updateSeekCost(state.seek_cost, state.seek_samples, time);
+        }
+        position = landed;
+    }
+    else if(target > position){
+        addStatistic(run_statistics[STAT_SEEK_SKIPS], 1);
+    }
 
-            text_txt[_name] = text;
-            text_x[_name] = x;
-            text_y[_name] = y;
+    /// Frames are grabbed without being retrieved
+    int64 start = getTickCount();
+    int grabbed = 0;
+    while(position < target){
+        if(!capture.grab()){
+            position = -1;
+            return false;
+        }
+        position++;
+        grabbed++;
+    }
+    if(grabbed > 0){
+        double time = (double)(getTickCount()-start)/frequency;
+        addStatistic(run_statistics[STAT_SEEK_DECODED], grabbed);
+        addStatistic(run_statistics[STAT_SEEK_DECODE_TIME], time);
+        std::unique_lock<std::mutex> lock(seek_cost_mutex);
+        updateSeekCost(state.grab_cost, state.grab_samples, time/grabbed);
+    }
+    return true;
+}
 
-            file << "," << text_x[_name];
-            file << "," << text_y[_name];
-            file << "," << text_txt[_name];
+void InspectorWidgetProcessor::updateSeekCost(double& cost, int& samples, double time){
+    /// Recent measurements weigh more, as costs vary along the video
+    cost = (samples == 0) ? time : 0.8*cost + 0.2*time;
+    samples++;
+}
 
-            csvfile[_name] << frame;
-            csvfile[_name] << "," << text_x[_name];
-            csvfile[_name] << "," << text_y[_name];
-            csvfile[_name] << "," << text_txt[_name];
-            csvfile[_name] << std::endl;
+bool InspectorWidgetProcessor::openFrameCapture(std::string videopath, int& width, int& height, int& frames, float& fps){
+    std::unique_lock<std::mutex> lock(frame_cache_mutex);
+    if(frame_capture_video != videopath || !frame_capture.isOpened()){
+        frame_capture.release();
+        frame_cache.clear();
+        frame_cache_index.clear();
+        frame_capture_video = "";
+        frame_capture_position = 0;
+        frame_capture_seek = InspectorWidgetSeekState();
+        if(!frame_capture.open(videopath)){
+            return false;
+        }
+        frame_capture_video = videopath;
+        frame_capture_seek.keyframes = indexKeyframes(videopath,(int)(frame_capture.get(CAP_PROP_FRAME_COUNT)));
+    }
+    width = (int)(frame_capture.get(CAP_PROP_FRAME_WIDTH));
+    height = (int)(frame_capture.get(CAP_PROP_FRAME_HEIGHT));
+    frames = (int)(frame_capture.get(CAP_PROP_FRAME_COUNT));
+    fps = frame_capture.get(CAP_PROP_FPS);
+    return true;
+}
 
-            annotation_progress[_name] = (float)frame/(float)this->video_frames;
-        }
+bool InspectorWidgetProcessor::readCachedFrame(std::string videopath, int frame, cv::Mat& image){
+    int width, height, frames;
+    float fps;
+    if(!openFrameCapture(videopath,width,height,frames,fps)){
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(frame_cache_mutex);
+    std::map<int,std::list<std::pair<int,cv::Mat> >::iterator>::iterator _f = frame_cache_index.find(frame);
+    if(_f != frame_cache_index.end()){
+        frame_cache.splice(frame_cache.begin(), frame_cache, _f->second);
+        image = frame_cache.front().second;
+        addStatistic(run_statistics[STAT_FRAMES_HITS], 1);
+        return true;
+    }
+    addStatistic(run_statistics[STAT_FRAMES_MISSES], 1);
 
+    /// Frames near the previous read are decoded forward from the shared capture
+    cv::Mat decoded;
+    if(!seekFrame(frame_capture,frame_capture_position,frame,frame_capture_seek) || !frame_capture.read(decoded) || decoded.empty()){
+        frame_capture_position = -1;
+        return false;
     }
+    frame_capture_position++;
+    frame_cache.push_front(std::make_pair(frame,decoded));
+    frame_cache_index[frame] = frame_cache.begin();
+    size_t size = (size_t)frame_cache_size;
+    while(frame_cache.size() > size){
+        frame_cache_index.erase(frame_cache.back().first);
+        frame_cache.pop_back();
+    }
+    image = decoded;
     return true;
 }
 
+void InspectorWidgetProcessor::clearFrameCache(){
+    std::unique_lock<std::mutex> lock(frame_cache_mutex);
+    frame_capture.release();
+    frame_capture_video = "";
+    frame_capture_position = 0;
+    frame_capture_seek = InspectorWidgetSeekState();
+    frame_cache.clear();
+    frame_cache_index.clear();
+}
 
 std::string InspectorWidgetProcessor::getStatusError(){
     return status_error;
@@ -1521,6 +4571,18 @@ bool InspectorWidgetProcessor::requiresProcessing(std::string name){
     return (annotation_progress[name]!=1.0) && (this->status_progress >= annotation_progress[name] );
 }
 
+bool InspectorWidgetProcessor::requiresProcessing(int annotation, InspectorWidgetFrameContext& ctx){
+    if(annotation < 0) return false;
+    float progress = ctx.annotation_progress[annotation];
+    return (progress!=1.0) && (ctx.status_progress >= progress );
+}
+
+bool InspectorWidgetProcessor::requiresProcessing(int annotation){
+    if(annotation < 0) return false;
+    float progress = *annotation_table.annotation_progress[annotation];
+    return (progress!=1.0) && (this->status_progress >= progress );
+}
+
 bool InspectorWidgetProcessor::setStatusAndReturn(std::string phase, std::string error_message, std::string success_message ){
     this->status_phase = phase;
     this->status_success = "";
@@ -1629,19 +4691,13 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
             return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
         }
 
-        /// Load video
-        cv::VideoCapture _cap;
-        _cap.open(videopath); // open a video file
-        if(!_cap.isOpened())  // check if succeeded
+        /// Load video, its capture is kept open for later template extractions
+        if(!openFrameCapture(videopath,this->video_w,this->video_h,this->video_frames,this->fps))  // check if succeeded
         {
             std::stringstream msg;
             msg << "file " << videopath << " not found or could not be opened";
             return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
         }
-        this->video_w = (int)(_cap.get(CAP_PROP_FRAME_WIDTH));
-        this->video_h = (int)(_cap.get(CAP_PROP_FRAME_HEIGHT));
-        this->fps = _cap.get(CAP_PROP_FPS);
-        this->video_frames = (int)(_cap.get(CAP_PROP_FRAME_COUNT));
         if(video_w == 0 || video_h == 0){
             std::stringstream msg;
             msg << "Null dimension(s) for video file " << videopath << " (x=" << video_w << " ,y=" << video_h << "), aborting";
@@ -1851,6 +4907,9 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
 
     /// Check constraints:
     /*bool*/ parse_full_video = false;
+    settings.clear();
+    annotation_settings.clear();
+    internSettings();
     bool needsHookEvents = false;
     bool needsAccessibility = false;
     for(std::vector<std::string>::iterator _constraint = constraint_list.begin(); _constraint!= constraint_list.end();_constraint++){
@@ -1865,6 +4924,7 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
         bool forConversion = false;
         bool forAccessibility = false;
         bool forInputHooks = false;
+        bool forSetting = false;
 
         /// Check if the constraint has a test statement:
         size_t _a_begin_loc = _c.find("{",0);
@@ -1971,7 +5031,9 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
                 && (std::find(supported_accessibility_tests.begin(),supported_accessibility_tests.end(),_t) != supported_accessibility_tests.end()  || _t.empty());
         forInputHooks = (std::find(supported_input_hook_actions.begin(),supported_input_hook_actions.end(),_a) != supported_input_hook_actions.end())
                 && (std::find(supported_input_hook_tests.begin(),supported_input_hook_tests.end(),_t) != supported_input_hook_tests.end()  || _t.empty());
-        if(!forConversion && !forExtraction && !forAccessibility && !forInputHooks){
+        forSetting = (std::find(supported_setting_actions.begin(),supported_setting_actions.end(),_a) != supported_setting_actions.end())
+                && _t.empty() && _n.empty();
+        if(!forConversion && !forExtraction && !forAccessibility && !forInputHooks && !forSetting){
             std::stringstream msg;
             msg << "Constraint '" << _c << "' has unsupported action statement " << _a << ", aborting";
             return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2007,6 +5069,23 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
             std::cout << *__av << " ";
         std::cout << std::endl;
 
+        /// Process setting statements: set(key,value) applies to all annotations, set(key,value,name...) to named annotations
+        if(forSetting){
+            if(_avs.size() < 2){
+                std::stringstream msg;
+                msg << "Constraint '" << _c << "' should set a key to a value, aborting";
+                return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
+            }
+            if(_avs.size() == 2){
+                settings[_avs[0]] = _avs[1];
+            }
+            for(std::vector<std::string>::iterator __av = _avs.begin()+2; __av != _avs.end(); __av++){
+                annotation_settings[*__av][_avs[0]] = _avs[1];
+            }
+            internSettings();
+            continue;
+        }
+
         /// Process extraction statements:
         if(forExtraction){
 
@@ -2048,20 +5127,16 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
 
                 std::string _videopath = datapath + _videostem + ".mp4";
                 /// Load image and template
-                cv::VideoCapture _cap;
-                _cap.open(_videopath); // open a video file
-                if(!_cap.isOpened())  // check if succeeded
+                /// Frames are read through the shared capture and its cache of decoded frames
+                int _video_w = 0, _video_h = 0, _video_frames = 0;
+                float _fps = 0;
+                if(!openFrameCapture(_videopath,_video_w,_video_h,_video_frames,_fps))
                 {
                     std::stringstream msg;
                     msg << "File " << _videopath << " not found or could not be opened";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
                 }
-                int _video_w = (int)(_cap.get(CAP_PROP_FRAME_WIDTH));
-                int _video_h = (int)(_cap.get(CAP_PROP_FRAME_HEIGHT));
-                int _video_frames = (int)(_cap.get(CAP_PROP_FRAME_COUNT));
-                float _fps = _cap.get(CAP_PROP_FPS);
                 if(_video_w == 0 || _video_h == 0 || _fps == 0 || _video_frames == 0){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Null dimension(s) for video file " << _videopath << " (w=" << _video_w << " ,h=" << _video_h << " ,fps=" << _fps<< " ,frames=" << _video_frames <<"), aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2072,7 +5147,6 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
                 int _w = int( _video_w * atof(_avs[2].c_str()) );
                 int _h = floor( _video_h * atof(_avs[3].c_str()) );
                 if(_w == 0 || _h == 0){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Null dimension(s) for video file " << _videopath << " (x=" << _x << " ,y=" << _y << " ,w=" << _w << " ,h=" << _h <<"), aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2083,19 +5157,15 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
 
                 int _frame_pos = (int)(_t*_fps);
                 if(_frame_pos < 0 || _frame_pos > _video_frames ){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Frame position incompatible with video file " << _videopath << " : asked=" << _frame_pos << " ,max=" << _video_frames <<"), aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
                 }
 
-                _cap.set(CAP_PROP_POS_FRAMES,_frame_pos);
-
                 cv::Mat _frame;
-                bool _frame_read = _cap.read(_frame);
+                bool _frame_read = readCachedFrame(_videopath,_frame_pos,_frame);
 
                 if(!_frame_read){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Couldn't read the required frame for template "<< _n << " in video file " << _videopath <<" , aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2107,7 +5177,6 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
                 std::cout << _templatefile << std::endl;
                 bool _frame_written = cv::imwrite(_templatefile.c_str(),_template);
                 if(!_frame_written){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Couldn't save the template "<< _n << " from video file " << _videopath <<" , aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2115,7 +5184,6 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
 
                 //template_list.push_back(_n); // The next action depending on it will add it to the template list
 
-                _cap.release();
             }
 
             if(_t.empty()){
@@ -2279,20 +5347,17 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
 
                 std::string _videopath = datapath + _videostem + ".mp4";
                 /// Load image and template
-                cv::VideoCapture _cap;
-                _cap.open(_videopath); // open a video file
-                if(!_cap.isOpened())  // check if succeeded
+                /// Frames are read through the shared capture and its cache of decoded frames
+                int _video_w = 0, _video_h = 0, _video_frames = 0;
+                float _fps = 0;
+                if(!openFrameCapture(_videopath,_video_w,_video_h,_video_frames,_fps))
                 {
                     std::stringstream msg;
                     msg << "File " << _videopath << " not found or could not be opened";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
                 }
-                int _video_w = (int)(_cap.get(CAP_PROP_FRAME_WIDTH));
-                int _video_h = (int)(_cap.get(CAP_PROP_FRAME_HEIGHT));
-                this->video_frames = (int)(_cap.get(CAP_PROP_FRAME_COUNT));
-                float _fps = _cap.get(CAP_PROP_FPS);
+                this->video_frames = _video_frames;
                 if(_video_w == 0 || _video_h == 0 || _fps == 0 || this->video_frames == 0){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Null dimension(s) for video file " << _videopath << " (w=" << _video_w << " ,h=" << _video_h << " ,fps=" << _fps<< " ,frames=" << this->video_frames <<"), aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2303,7 +5368,6 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
                 int _w = int( _video_w * atof(_avs[2].c_str()) );
                 int _h = floor( _video_h * atof(_avs[3].c_str()) );
                 if(_w == 0 || _h == 0){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Null dimension(s) for video file " << _videopath << " (x=" << _x << " ,y=" << _y << " ,w=" << _w << " ,h=" << _h <<"), aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2314,19 +5378,15 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
 
                 int _frame_pos = (int)(_t*_fps);
                 if(_frame_pos < 0 || _frame_pos > this->video_frames ){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Frame position incompatible with video file " << _videopath << " : asked=" << _frame_pos << " ,max=" << this->video_frames <<"), aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
                 }
 
-                _cap.set(CAP_PROP_POS_FRAMES,_frame_pos);
-
                 cv::Mat _frame;
-                bool _frame_read = _cap.read(_frame);
+                bool _frame_read = readCachedFrame(_videopath,_frame_pos,_frame);
 
                 if(!_frame_read){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Couldn't read the required frame for accessible "<< _n << " in video file " << _videopath <<" , aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2338,7 +5398,6 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
                 std::cout << _templatefile << std::endl;
                 bool _frame_written = cv::imwrite(_templatefile.c_str(),_template);
                 if(!_frame_written){
-                    _cap.release();
                     std::stringstream msg;
                     msg << "Couldn't save accessible "<< _n << " from video file " << _videopath <<" , aborting";
                     return setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
@@ -2352,7 +5411,6 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
                 ax_id[_n] = _videostem;
                 //ax_list.push_back(_n); // done by matchAccessible
 
-                _cap.release();
             }
             else if (_a == "matchAccessible"){
                 //if(_t.empty()){
@@ -2556,14 +5614,24 @@ bool InspectorWidgetProcessor::init( std::vector<std::string> argv ){
     //cv::Mat ref_gray, tpl_gray;
     //cv::cvtColor(templ, tpl_gray, COLOR_BGR2GRAY);
 
+    /// Template pyramids also cover the coarsest level used by reduced resolution analysis
+    analysislevels = 0;
+    for(std::map<std::string,cv::Mat>::iterator _t = templates.begin(); _t != templates.end(); _t++){
+        analysislevels = std::max(analysislevels, std::min(4, (int)getSetting("analysisLevel",0,_t->first)));
+    }
+
     //std::vector<Mat> gray_templates;
     for(std::map<std::string,cv::Mat>::iterator _t = templates.begin(); _t != templates.end(); _t++){
         cv::Mat gray_template;
         cv::cvtColor(_t->second, gray_template, COLOR_BGR2GRAY);
         //gray_template.copyTo(gray_templates[_t->first]);
         gray_templates[_t->first] = gray_template.clone();
+        cv::buildPyramid(gray_templates[_t->first], gray_template_pyramids[_t->first], fastmatchlevels + analysislevels);
     }
 
+    /// The per-frame loop only works on indices resolved from annotation names here
+    internAnnotations();
+
     //cv::Mat dst;
     //return true;
 
@@ -2734,6 +5802,8 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
     frame = 0;
     //cap.set(CAP_PROP_POS_FRAMES,frame);
     std::string videopath = datapath + videostem + ".mp4";
+    /// Grayscale frames are decoded directly from the luma plane when no annotation needs color
+    cap.setLuma(getSetting("lumaDecode",0) > 0 && !with_gui);
     cap.open(videopath); // open a video file
     if(!cap.isOpened())  // check if succeeded
     {
@@ -2747,11 +5817,79 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
 
     /*int*/ csv_frame = frame;
     int last_cap_frame = frame;
+    int cap_position = frame;
 
+    /// Random access seeks to the nearest keyframe then decodes forward
     this->video_frames = (int)(cap.get(CAP_PROP_FRAME_COUNT));
 
+    cap_seek = InspectorWidgetSeekState();
+    cap_seek.keyframes = indexKeyframes(videopath,this->video_frames);
+
     //cv::Mat img;
 
+    {
+        /// Values are zeroed rather than erased since interned statistics point to them
+        std::unique_lock<std::mutex> lock(statistics_mutex);
+        for(std::map<std::string,double>::iterator _s = statistics.begin(); _s != statistics.end(); _s++){
+            _s->second = 0;
+        }
+    }
+
+    /// Text regions can be recognized by dedicated workers while frames are decoded and matched
+    int ocr_workers_count = text_detect_list.empty() ? 0 : (int)getSetting("ocrWorkers",0);
+    startOcrWorkers(ocr_workers_count,(int)getSetting("ocrMaxInFlight",4*ocr_workers_count));
+
+    /// OCR results of previous runs are kept next to the video
+    std::string ocrcachepath = datapath + videostem + "-ocr.cache";
+    bool persistOcrCache = getSetting("ocrCachePersist",0) > 0 && !text_detect_list.empty();
+    if(persistOcrCache){
+        loadOcrCache(ocrcachepath);
+    }
+
+    /// Full video parsing decodes, analyzes and writes frames concurrently when frames do not depend on previous ones
+    if(parse_full_video && !with_gui && framesAreIndependent() && (computeComputerVisionBisection() || computeComputerVisionShards() || computeComputerVisionPipeline())){
+        if(frame < this->video_frames){
+            stopOcrWorkers();
+            if(persistOcrCache){
+                saveOcrCache(ocrcachepath);
+            }
+            reportStatistics();
+            return;
+        }
+    }
+    else{
+        prepareFrameContext(frame_context);
+    }
+
+    /// With OCR workers, text of a frame is committed after the next frame is decoded and matched so that recognition overlaps them
+    /// Sparse parsing starts the line of a frame at its first value, once the text of the previous line is committed
+    bool defer_text = !ocr_workers.empty();
+    InspectorWidgetFrameResult pending_text;
+    bool text_pending = false;
+    bool line_started = true;
+    auto commitPendingText = [&](){
+        if(!text_pending) return;
+        commitTextDetections(pending_text);
+        if(!parse_full_video){
+            file << std::endl;
+        }
+        text_pending = false;
+    };
+    auto deferTextDetections = [&](InspectorWidgetFrameResult& result){
+        if(!defer_text){
+            commitTextDetections(result);
+            return;
+        }
+        std::swap(pending_text,result);
+        text_pending = true;
+    };
+    auto startLine = [&](){
+        if(line_started) return;
+        commitPendingText();
+        file << frame;
+        line_started = true;
+    };
+
     while(frame < this->video_frames)
     {
         this->status_progress = (float)frame/(float)this->video_frames;
@@ -2769,6 +5907,8 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
             std::stringstream msg;
             msg << "Abort requested for video file " << videostem << "), aborting";
             /*return*/ setStatusAndReturn(/*phase*/"init",/*error*/msg.str(), /*success*/"");
+            commitPendingText();
+            stopOcrWorkers();
             return;
         }
 
@@ -2778,36 +5918,44 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
         bool needsTemplateMatching = false;
         bool needsTextDetection = false;
 
+        frame_context.frame = frame;
+        frame_context.csv_frame = csv_frame;
+        frame_context.status_progress = this->status_progress;
+
         if(parse_full_video){
-            cap.read(img);
+            cap.read(frame_context.img);
 
             //file << frame;
-            this->matchTemplates();
-            this->detectText();
+            frame_context.result.reset(frame,template_list.size(),text_detect_list.size());
+            this->matchTemplates(frame_context);
+            this->detectText(frame_context);
+            commitPendingText();
+            commitTemplateMatches(frame_context.result);
+            deferTextDetections(frame_context.result);
             //file << std::endl;
         }
         else{
             bool skip_analysis = true;
             while(csv_frame < this->video_frames && skip_analysis){
                 this->status_progress = (float)frame/(float)this->video_frames;
-                file << frame;
+                line_started = false;
+                bool text_deferred = false;
 
                 // Match templates
 
-                for(std::map<std::string,std::string >::iterator _template_matching_test = template_matching_test.begin(); _template_matching_test != template_matching_test.end(); _template_matching_test++){
-                    needsTemplateMatching |= _template_matching_test->second.empty() && requiresProcessing(_template_matching_test->first);
+                /// Dependencies were resolved to annotation and logged indices by internAnnotations
+                InspectorWidgetAnnotationTable& table = annotation_table;
+                for(std::vector<int>::iterator _a = table.always_annotations.begin(); _a != table.always_annotations.end(); _a++){
+                    needsTemplateMatching |= requiresProcessing(*_a);
                 }
-                for(std::list<std::string>::iterator template_matching_logged_dep = template_matching_logged_dep_list.begin(); template_matching_logged_dep != template_matching_logged_dep_list.end();template_matching_logged_dep++){
-                    needsTemplateMatching |= (log_val[*template_matching_logged_dep][csv_frame]>_threshold) && requiresProcessing(*template_matching_logged_dep);
+                for(std::vector<std::pair<int,int> >::iterator _c = table.template_logged_checks.begin(); _c != table.template_logged_checks.end(); _c++){
+                    needsTemplateMatching |= ((*table.logged_val[_c->first])[csv_frame]>_threshold) && requiresProcessing(_c->second);
                 }
-                for(std::list<std::string>::iterator template_matching_new_dep = template_matching_new_dep_list.begin(); template_matching_new_dep != template_matching_new_dep_list.end();template_matching_new_dep++){
-                    needsTemplateMatching |= requiresProcessing(*template_matching_new_dep);
+                for(std::vector<int>::iterator _a = table.template_new_checks.begin(); _a != table.template_new_checks.end(); _a++){
+                    needsTemplateMatching |= requiresProcessing(*_a);
                 }
-                for(std::list<std::string>::iterator text_detect_new_dep = text_detect_new_dep_list.begin(); text_detect_new_dep != text_detect_new_dep_list.end();text_detect_new_dep++){
-                    needsTemplateMatching |= requiresProcessing(*text_detect_new_dep);
-                }
-                for(std::vector<std::string>::iterator _name = template_list.begin(); _name != template_list.end(); _name++ ){
-                    needsTemplateMatching |= (inrect_map.find(*_name)!=inrect_map.end()) && requiresProcessing(*_name);
+                for(std::vector<int>::iterator _a = table.inrect_annotations.begin(); _a != table.inrect_annotations.end(); _a++){
+                    needsTemplateMatching |= requiresProcessing(*_a);
                 }
 
                 skip_analysis = !needsTemplateMatching;
@@ -2817,12 +5965,13 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
 
                 if(needsTemplateMatching){
                     if(csv_frame-last_cap_frame>1){
-                        bool has_seeked = cap.set(CAP_PROP_POS_FRAMES,csv_frame+1);
+                        bool has_seeked = seekFrame(cap,cap_position,csv_frame+1,cap_seek);
                         if(!has_seeked){
                             std::cerr << "Problem seeking to frame " << csv_frame+1 << std::endl;
                             skip_analysis = true;
                             seek_error = true;
 
+                            startLine();
                             for(std::map<std::string,cv::Mat>::iterator _template = templates.begin(); _template!=templates.end();_template++){
                                 //std::string template_name = getStemName(*_template);
                                 std::string template_name = getStemName(_template->first);
@@ -2848,11 +5997,19 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
                             start=stop;
                         }
                     }
-                    img_read = cap.read(img);
+                    img_read = cap.read(frame_context.img);
+                    /// A failed read leaves the capture in an unknown position
+                    cap_position = img_read ? cap_position+1 : -1;
 
                     if(img_read){
                         skip_analysis = false;
-                        this->matchTemplates();
+                        frame_context.frame = frame;
+                        frame_context.csv_frame = csv_frame;
+                        frame_context.status_progress = this->status_progress;
+                        frame_context.result.reset(frame,template_list.size(),text_detect_list.size());
+                        this->matchTemplates(frame_context);
+                        startLine();
+                        commitTemplateMatches(frame_context.result);
                     }
 
                     //last_cap_frame = csv_frame;
@@ -2860,6 +6017,7 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
 
                 if(!needsTemplateMatching){
 
+                    startLine();
                     for(std::map<std::string,cv::Mat>::iterator _template = templates.begin(); _template!=templates.end();_template++){
                         //std::string template_name = getStemName(*_template);
                         std::string template_name = getStemName(_template->first);
@@ -2879,20 +6037,20 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
 
                 // Detect text
 
-                for(std::list<std::string>::iterator text_detect_logged_dep = text_detect_logged_dep_list.begin(); text_detect_logged_dep != text_detect_logged_dep_list.end();text_detect_logged_dep++){
-                    needsTextDetection |= (log_val[*text_detect_logged_dep][csv_frame]>_threshold) && requiresProcessing(*text_detect_logged_dep);
+                for(std::vector<std::pair<int,int> >::iterator _c = table.text_logged_checks.begin(); _c != table.text_logged_checks.end(); _c++){
+                    needsTextDetection |= ((*table.logged_val[_c->first])[csv_frame]>_threshold) && requiresProcessing(_c->second);
                 }
-                for(std::list<std::string>::iterator text_detect_new_dep = text_detect_new_dep_list.begin(); text_detect_new_dep != text_detect_new_dep_list.end();text_detect_new_dep++){
-                    needsTextDetection |= (template_val[*text_detect_new_dep]>_threshold) && requiresProcessing(*text_detect_new_dep);
+                for(std::vector<std::pair<int,int> >::iterator _c = table.text_new_checks.begin(); _c != table.text_new_checks.end(); _c++){
+                    needsTextDetection |= (_c->first >= 0 ? *table.template_val[_c->first] : 0)>_threshold && requiresProcessing(_c->second);
                 }
-                for(std::set<std::string>::iterator _name = text_detect_list.begin(); _name != text_detect_list.end(); _name++ ){
-                    needsTextDetection |= (inrect_map.find(*_name)!=inrect_map.end()) && requiresProcessing(*_name);
+                for(std::vector<int>::iterator _a = table.text_inrect_annotations.begin(); _a != table.text_inrect_annotations.end(); _a++){
+                    needsTextDetection |= requiresProcessing(*_a);
                 }
 
                 if(needsTextDetection){
                     if(!img_read){
                         if(csv_frame-last_cap_frame>1){
-                            bool has_seeked = cap.set(CAP_PROP_POS_FRAMES,csv_frame+1);
+                            bool has_seeked = seekFrame(cap,cap_position,csv_frame+1,cap_seek);
                             if(!has_seeked){
                                 std::cerr << "Problem seeking to frame " << csv_frame+1 << std::endl;
                                 skip_analysis = true;
@@ -2905,13 +6063,27 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
                                 start=stop;
                             }
                         }
-                        img_read = cap.read(img);
+                        img_read = cap.read(frame_context.img);
+                        cap_position = img_read ? cap_position+1 : -1;
 
                     }
 
                     if(img_read){
                         skip_analysis = false;
-                        this->detectText();
+                        frame_context.frame = frame;
+                        frame_context.csv_frame = csv_frame;
+                        frame_context.status_progress = this->status_progress;
+                        frame_context.result.reset(frame,template_list.size(),text_detect_list.size());
+                        this->detectText(frame_context);
+                        startLine();
+                        /// The line ends with the deferred text, unless zeros follow for a seek error
+                        if(seek_error){
+                            commitTextDetections(frame_context.result);
+                        }
+                        else{
+                            deferTextDetections(frame_context.result);
+                            text_deferred = defer_text;
+                        }
                     }
 
 
@@ -2919,6 +6091,7 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
                 }
 
                 if(!needsTextDetection || seek_error){
+                    startLine();
                     for(int a=0; a<text_detect_list.size();a++){
                         file << "," << 0;
                         file << "," << 0;
@@ -2938,7 +6111,10 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
                     frame++;
                 }
 
-                file << std::endl;
+                startLine();
+                if(!text_deferred){
+                    file << std::endl;
+                }
 
                 csv_frame++;
 
@@ -2948,7 +6124,7 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
 
         if(with_gui){
             cv::waitKey(1);
-            cv::imshow( image_window, img );
+            cv::imshow( image_window, frame_context.img );
         }
 
         int stop = getTickCount();
@@ -2960,6 +6136,7 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
         frame++;
 
     }
+    commitPendingText();
     if(active){
         this->status_progress = (frame == this->video_frames ? 1.0 : 0.0);
         for(std::map<std::string,cv::Mat>::iterator _template = templates.begin(); _template!=templates.end();_template++){
@@ -2971,6 +6148,11 @@ void InspectorWidgetProcessor::computeComputerVisionAnnotations(){
             std::cout << "Annotation progress for " << *_text_detection << ": " << annotation_progress[*_text_detection] << std::endl;
         }
     }
+    stopOcrWorkers();
+    if(persistOcrCache){
+        saveOcrCache(ocrcachepath);
+    }
+    reportStatistics();
 }
 
 
@@ -32,6 +32,11 @@
 #include <list>
 #include <set>
 
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
 #include "opencv2/core/version.hpp"
 #include "opencv2/core/core.hpp"
 #define CV_VERSION_CHECK(major, minor, patch) ((major<<16)|(minor<<8)|(patch))
@@ -44,6 +49,7 @@
 #define CAP_PROP_FPS CV_CAP_PROP_FPS 
 #define CAP_PROP_FRAME_COUNT CV_CAP_PROP_FRAME_COUNT 
 #define CAP_PROP_POS_FRAMES CV_CAP_PROP_POS_FRAMES
+#define CAP_PROP_POS_MSEC CV_CAP_PROP_POS_MSEC
 #ifndef WINDOW_KEEPRATIO
 #define WINDOW_KEEPRATIO 0x00000000
 #endif
@@ -51,6 +57,8 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "InspectorWidgetProcessorCommandParser.h"
+#include "InspectorWidgetLumaCapture.h"
+#include "InspectorWidgetNccKernel.h"
 
 ////Methods:
 ////0: SQDIFF
@@ -88,6 +96,66 @@ void fastMatchTemplate(cv::Mat& srca,  // The reference image
                        int maxlevel,   // Number of levels
                        int match_method);
 
+/// Splits a text region into normalized glyph images and the gaps before them
+void segmentGlyphs(const cv::Mat& image, std::vector<cv::Mat>& glyphs, std::vector<int>& gaps, int& line_height);
+
+/// Default score a coarse candidate must reach to be searched at the next level
+double fastMatchPruningThreshold(int match_method);
+
+/// Matching buffers of one thread, reused by all its templates
+/// Buffers are views into capacities reserved for the largest results, so they only grow when a result exceeds them
+struct InspectorWidgetMatchWorkspace {
+    std::vector<cv::Mat> results;
+    cv::Mat window;
+    cv::Mat scores;
+    std::vector<cv::Point> peaks;
+    std::vector<cv::Rect> rects;
+    /// NCC kernel for TM_CCOEFF_NORMED, used for windows and for coarsest levels of templates up to kernel_size
+    /// Coarsest levels read the integral images of the frame level, windows get their own
+    bool kernel;
+    InspectorWidgetNccKernelLevel kernel_level;
+    int kernel_size;
+    cv::Mat coarse_sums,coarse_sqsums;
+    cv::Mat window_sums,window_sqsums;
+    int allocations;
+    int reported_allocations;
+    InspectorWidgetMatchWorkspace():kernel(false),kernel_level(NCC_KERNEL_SCALAR),kernel_size(0),allocations(0),reported_allocations(0){}
+    /// View of size and type into capacity, which grows if needed
+    cv::Mat buffer(cv::Mat& capacity, cv::Size size, int type);
+    /// Allocates the result capacities of each level, the window and the scores
+    void reserve(const std::vector<cv::Size>& level_sizes);
+};
+
+void fastMatchCandidates(const cv::Mat& res,  // Template matching result
+                         cv::Size suppression, // Neighborhood suppressed around each peak
+                         int match_method,
+                         int candidates,       // Maximum number of peaks
+                         double threshold,     // Pruning threshold
+                         std::vector<cv::Point>& peaks,
+                         cv::Mat scores = cv::Mat()); // Buffer of the size and type of res, allocated if empty
+
+void fastMatchTemplate(const std::vector<cv::Mat>& refs,  // Gaussian pyramid of the reference image
+                       const std::vector<cv::Mat>& tpls,  // Gaussian pyramid of the template image
+                       cv::Mat& dst,   // Template matching result
+                       int maxlevel,   // Number of levels
+                       int match_method,
+                       int candidates,    // Maximum number of peaks searched at the next level
+                       double threshold,  // Pruning threshold of the peaks
+                       int margin = 2);   // Search radius around each upscaled peak
+
+/// Same as above without allocating in steady state, dst being a view into the workspace
+void fastMatchTemplate(const std::vector<cv::Mat>& refs,
+                       const std::vector<cv::Mat>& tpls,
+                       cv::Mat& dst,
+                       int maxlevel,
+                       int match_method,
+                       int candidates,
+                       double threshold,
+                       InspectorWidgetMatchWorkspace& workspace,
+                       int margin = 2,
+                       const std::vector<cv::Rect>* windows = 0, // Result windows searched at the coarsest level, all of it if null
+                       bool coarse_matched = false);             // The coarsest result is already in the workspace
+
 struct InspectorWidgetDate {
     int y;
     int m;
@@ -129,6 +197,287 @@ struct InspectorWidgetAnnnotationProgress {
     InspectorWidgetAnnnotationProgress():name(""),annotation(""),progress(0.0){}
 };
 
+/// Template to be extracted from a video frame: rect in ratios of video sizes, time in sec
+struct InspectorWidgetTemplateRequest {
+    std::string name;
+    float x;
+    float y;
+    float w;
+    float h;
+    float time;
+    InspectorWidgetTemplateRequest():name(""),x(0),y(0),w(0),h(0),time(0){}
+};
+
+namespace tesseract {
+class TessBaseAPI;
+}
+
+/// Sorted keyframe positions of a video, shared read-only by the captures of that video
+struct InspectorWidgetKeyframeIndex {
+    std::vector<int> frames;
+    /// Presentation times of the keyframes from the start of the stream, in milliseconds, which captures seek to
+    std::vector<double> times;
+};
+
+/// Seeking state of one video for the captures that read it: its keyframe index and measured costs of seeking and decoding, in seconds
+struct InspectorWidgetSeekState {
+    std::shared_ptr<const InspectorWidgetKeyframeIndex> keyframes;
+    double seek_cost, grab_cost;
+    int seek_samples, grab_samples;
+    InspectorWidgetSeekState():seek_cost(0),grab_cost(0),seek_samples(0),grab_samples(0){}
+};
+
+/// Raw Tesseract output for a thresholded text region
+struct InspectorWidgetOcrCacheEntry {
+    uint64 hash;
+    std::string type;
+    cv::Mat image;
+    std::string text;
+};
+
+/// Text region of one frame to be recognized, possibly by an OCR worker
+struct InspectorWidgetOcrJob {
+    int frame;
+    int region;  // Index of the text region in the annotation table
+    std::string name;
+    std::string type;
+    cv::Mat image;
+    std::string text;
+    std::string log;
+    bool done;
+    /// Tesseract read to learn glyphs from when the frame is committed, negative confidence if none
+    std::string learn_text;
+    int learn_confidence;
+    InspectorWidgetOcrJob():frame(-1),region(-1),text(" "),done(false),learn_confidence(-1){}
+};
+
+/// Tests placing the region where a template is matched or text is detected
+enum InspectorWidgetRegionTest { REGION_FRAME, REGION_INRECT, REGION_BELOW, REGION_RIGHTOF, REGION_BETWEEN };
+
+/// Where the single dependency of a below or rightof test is found
+enum InspectorWidgetAnchorSource { ANCHOR_LOGGED, ANCHOR_TEMPLATE, ANCHOR_MISSING, ANCHOR_NOT_SINGLE };
+
+/// Statistics counted per template in the per-frame loop
+enum InspectorWidgetTemplateStatistic {
+    STAT_GATING_SKIPPED, STAT_GATING_MATCHED,
+    STAT_TRACKING_HITS, STAT_TRACKING_MISSES,
+    STAT_DIRTY_FULL, STAT_DIRTY_INCREMENTAL, STAT_DIRTY_SEARCHED, STAT_DIRTY_REGION,
+    STAT_SCALE_COARSE, STAT_SCALE_REFINED,
+    STAT_PREFILTER_POSITIONS, STAT_PREFILTER_SEARCHED, STAT_PREFILTER_SKIPPED,
+    STAT_EXACT_HITS, STAT_EXACT_FALLBACKS,
+    STAT_FFT_MATCHES,
+    STAT_TEMPLATE_COUNT
+};
+
+/// Statistics counted per seek, decoded frame or OCR cache lookup
+enum InspectorWidgetRunStatistic {
+    STAT_SEEK_SAVED, STAT_SEEK_KEYFRAME, STAT_SEEK_BACKEND, STAT_SEEK_MISSED, STAT_SEEK_TIME,
+    STAT_SEEK_SKIPS, STAT_SEEK_DECODED, STAT_SEEK_DECODE_TIME,
+    STAT_FRAMES_HITS, STAT_FRAMES_MISSES,
+    STAT_OCR_HITS, STAT_OCR_MISSES,
+    STAT_RUN_COUNT
+};
+
+/// Statistics counted per text region read with learned glyphs, shared by the regions of an OCR type
+enum InspectorWidgetGlyphStatistic {
+    STAT_GLYPH_RECOGNIZED, STAT_GLYPH_FALLBACKS, STAT_GLYPH_TIME, STAT_GLYPH_TESSERACT_TIME, STAT_GLYPH_AGREED,
+    STAT_GLYPH_COUNT
+};
+
+/// Annotation names resolved once at init to dense indices, with per-annotation state as parallel arrays
+/// Templates are indexed like template_list, texts like text_detect_list and logged templates like log_val,
+/// annotations number the names of both lists, a name listed twice having a single annotation
+/// Pointers are slots of the maps that committed values update, stable until these maps are cleared
+struct InspectorWidgetAnnotationTable {
+    /// Templates
+    std::vector<int> template_annotation;
+    std::vector<int> template_test;
+    std::vector<uchar> template_always;
+    std::vector<uchar> template_inrect;
+    std::vector<cv::Rect> template_rect;
+    std::vector<int> template_w,template_h;
+    std::vector<std::vector<int> > template_logged_deps;
+    std::vector<std::vector<int> > template_new_deps;
+    std::vector<int> template_anchor;
+    std::vector<int> template_anchor_source;
+    std::vector<cv::Mat> gray_templates;
+    std::vector<std::vector<cv::Mat> > gray_template_pyramids;
+    std::vector<uchar> dirty_matching,tracking,tracking_fallback;
+    std::vector<int> prune_candidates,analysis_level,tracking_window;
+    std::vector<double> prune_threshold,analysis_margin;
+    /// Window statistics prefilter, with the mean and standard deviation of each template pyramid level
+    std::vector<uchar> prefilter;
+    std::vector<double> prefilter_contrast,prefilter_brightness;
+    std::vector<std::vector<double> > template_means,template_stddevs;
+    /// Exact matching, with the rolling hash of each gray template
+    std::vector<uchar> exact_matching;
+    std::vector<uint64> exact_hashes;
+    /// Frequency-domain correlation at the coarsest full frame level of each template, chosen by a cost model
+    /// Template spectra are padded to the frame spectrum size of their level, with the sums normalizing the correlation
+    std::vector<uchar> fft_matching;
+    std::vector<int> fft_level;
+    std::vector<cv::Mat> template_spectra;
+    std::vector<double> fft_template_sum,fft_template_sqsum;
+    std::vector<cv::Size> fft_frame_sizes,fft_sizes;
+    std::vector<std::string> template_debug_path;
+    std::vector<std::vector<double*> > template_statistics;
+    std::vector<float*> template_x,template_y,template_val;
+    std::vector<std::vector<float>*> template_vals;
+    std::vector<std::ofstream*> template_csv;
+
+    /// Text regions
+    std::vector<int> text_annotation;
+    std::vector<int> text_test;
+    std::vector<uchar> text_inrect;
+    std::vector<cv::Rect> text_rect;
+    std::vector<std::vector<int> > text_logged_deps;
+    std::vector<std::vector<int> > text_new_deps;
+    std::vector<std::string> text_type;
+    std::vector<uchar> text_threshold;
+    /// Learned glyphs, with the glyph set of each region indexed by its OCR type
+    std::vector<std::string> text_types;
+    std::vector<int> text_type_id;
+    std::vector<uchar> text_glyphs;
+    std::vector<double> text_glyph_threshold;
+    std::vector<int> text_glyph_confidence;
+    std::vector<std::vector<double*> > text_glyph_statistics;
+    bool benchmark_glyphs;
+    std::string text_debug_path;
+    std::vector<float*> text_x,text_y;
+    std::vector<std::string*> text_txt;
+    std::vector<std::ofstream*> text_csv;
+
+    /// Logged templates
+    std::vector<const std::vector<float>*> logged_val,logged_x,logged_y;
+    std::vector<int> logged_w,logged_h;
+
+    /// Annotations, the listed ones being those that are templates or texts
+    std::vector<std::string> annotation_names;
+    std::vector<float*> annotation_progress;
+
+    /// Checks deciding whether a frame needs analysis when the video is sampled from logged values
+    std::vector<int> always_annotations;
+    std::vector<std::pair<int,int> > template_logged_checks;
+    std::vector<int> template_new_checks;
+    std::vector<std::pair<int,int> > text_logged_checks;
+    std::vector<std::pair<int,int> > text_new_checks;
+    std::vector<int> inrect_annotations;
+    std::vector<int> text_inrect_annotations;
+
+    bool gating,benchmark_matching,benchmark_overhead;
+    bool ncc_kernel,benchmark_kernel;
+    InspectorWidgetNccKernelLevel ncc_kernel_level;
+    int ncc_kernel_size;
+    int gating_block_size;
+    int prefilter_block_size;
+    std::vector<cv::Size> workspace_sizes;
+    double* workspace_reserved;
+    double* workspace_allocations;
+    double* overhead_frames;
+    double* overhead_time;
+    double* overhead_image_time;
+    InspectorWidgetAnnotationTable():benchmark_glyphs(false),gating(true),benchmark_matching(false),benchmark_overhead(false),ncc_kernel(false),benchmark_kernel(false),ncc_kernel_level(NCC_KERNEL_SCALAR),ncc_kernel_size(0),gating_block_size(16),prefilter_block_size(8),workspace_reserved(0),workspace_allocations(0),overhead_frames(0),overhead_time(0),overhead_image_time(0){}
+};
+
+/// Computer vision values of one frame, buffered until committed in frame order
+/// Vectors are indexed like template_list and text_detect_list
+/// Debug images are indexed like template_list, followed by the text detection image
+struct InspectorWidgetFrameResult {
+    int frame;
+    std::vector<bool> template_processed;
+    std::vector<bool> template_matched;
+    std::vector<float> template_x;
+    std::vector<float> template_y;
+    std::vector<float> template_val;
+    std::vector<bool> text_processed;
+    std::vector<float> text_x;
+    std::vector<float> text_y;
+    std::vector<std::string> text_txt;
+    std::vector<std::shared_ptr<InspectorWidgetOcrJob> > text_jobs;
+    std::vector<cv::Mat> debug_images;
+    std::string log;
+    double analysis_time;
+    InspectorWidgetFrameResult():frame(-1),analysis_time(0){}
+    void reset(int _frame, size_t templates, size_t texts){
+        frame = _frame;
+        template_processed.assign(templates,false);
+        template_matched.assign(templates,false);
+        template_x.assign(templates,0);
+        template_y.assign(templates,0);
+        template_val.assign(templates,0);
+        text_processed.assign(texts,false);
+        text_x.assign(texts,0);
+        text_y.assign(texts,0);
+        text_txt.assign(texts," ");
+        text_jobs.assign(texts,std::shared_ptr<InspectorWidgetOcrJob>());
+        debug_images.assign(templates + 1,cv::Mat());
+        log.clear();
+        analysis_time = 0;
+    }
+};
+
+/// Last match of a template, carried forward while its region does not change
+struct InspectorWidgetMatchRecord {
+    int analysis;
+    cv::Rect rect;
+    cv::Point loc;
+    double val;
+    double minVal,maxVal;
+    InspectorWidgetMatchRecord():analysis(-1),val(0),minVal(0),maxVal(0){}
+};
+
+/// Analysis state carried by one thread from frame to frame
+struct InspectorWidgetFrameContext {
+    int frame;
+    int csv_frame;
+    float status_progress;
+    cv::Mat img;
+    cv::Mat ref_gray;
+    std::vector<cv::Mat> ref_pyramid;
+    cv::Mat dst;
+    int analyses;
+    cv::Mat previous_gray;
+    bool changes_valid;
+    int block_size,block_cols;
+    std::vector<uchar> changed_blocks;
+    int dirty_analysis;
+    std::vector<cv::Rect> dirty_rects;
+    /// Indexed like the arrays of InspectorWidgetAnnotationTable
+    std::vector<InspectorWidgetMatchRecord> match_records;
+    std::vector<float> template_x,template_y,template_val;
+    std::vector<float> text_x,text_y;
+    std::vector<float> annotation_progress;
+    std::vector<cv::Mat> refs,tpls;
+    InspectorWidgetMatchWorkspace workspace;
+    std::vector<uchar> dirty_visited;
+    std::vector<int> dirty_stack;
+    /// Integral images of the gray frame pyramid levels, computed on demand once per analysis
+    std::vector<cv::Mat> ref_sums,ref_sqsums;
+    std::vector<int> integral_analyses;
+    std::vector<cv::Rect> prefilter_windows;
+    /// Rolling hashes of the rows of the last region searched for exact matches, and of their columns
+    std::vector<uint64> row_hashes,column_hashes;
+    int row_hashes_analysis,row_hashes_width;
+    const uchar* row_hashes_data;
+    cv::Size row_hashes_size;
+    /// Spectra of the gray frame pyramid levels, computed on demand once per analysis
+    std::vector<cv::Mat> ref_spectra;
+    std::vector<int> spectrum_analyses;
+    cv::Mat fft_padded,fft_product,fft_correlation;
+    InspectorWidgetFrameResult result;
+    InspectorWidgetFrameContext():frame(0),csv_frame(0),status_progress(0),analyses(0),changes_valid(false),block_size(16),block_cols(0),dirty_analysis(-1),row_hashes_analysis(-1),row_hashes_width(0),row_hashes_data(0){}
+};
+
+/// Frame slot of the decode/analysis/write pipeline ring
+struct InspectorWidgetFrameSlot {
+    enum State { EMPTY, DECODED, ANALYZED };
+    State state;
+    int frame;
+    cv::Mat img;
+    InspectorWidgetFrameResult result;
+    InspectorWidgetFrameSlot():state(EMPTY),frame(-1){}
+};
+
 class InspectorWidgetProcessor{
     friend class InspectorWidgetProcessorCommandParser::operators;
 
@@ -153,6 +502,8 @@ public:
     InspectorWidgetAnnnotationProgress exportAnnotationForAmalia(std::string name);
     InspectorWidgetAnnnotationProgress getAnnotation(std::string name);
     bool extractTemplate(std::string name,float x, float y, float w, float h,std::string id, float time);
+    /// Extracts templates sorted by frame, decoding each frame once in a forward pass and writing images asynchronously
+    bool extractTemplates(const std::vector<InspectorWidgetTemplateRequest>& requests, std::string id);
     
     /// getAccessibilityHover
     /// time in sec
@@ -231,14 +582,126 @@ protected:
     float status_progress;
     bool active;
 
-    void matchTemplates();
-    bool detectText();
+    void matchTemplates(InspectorWidgetFrameContext& ctx);
+    bool detectText(InspectorWidgetFrameContext& ctx);
+    bool requiresProcessing(int annotation, InspectorWidgetFrameContext& ctx);
+    bool requiresProcessing(int annotation);
+    void prepareFrameContext(InspectorWidgetFrameContext& ctx);
+    void writeDebugImages(InspectorWidgetFrameResult& result);
+    void commitTemplateMatches(InspectorWidgetFrameResult& result);
+    /// Writes the template values of result as those of committed, which differs from result.frame for sampled frames
+    void writeTemplateMatches(const InspectorWidgetFrameResult& result, int committed);
+    void commitTextDetections(InspectorWidgetFrameResult& result);
+    void commitFrameResult(InspectorWidgetFrameResult& result);
+    void analyzeFrame(InspectorWidgetFrameContext& ctx, int f);
+    void updateChangedBlocks(InspectorWidgetFrameContext& ctx);
+    bool regionUnchanged(InspectorWidgetFrameContext& ctx, cv::Rect region);
+    std::vector<cv::Rect>& dirtyRects(InspectorWidgetFrameContext& ctx);
+    bool matchTrackingWindow(InspectorWidgetFrameContext& ctx, size_t index, cv::Rect region, cv::Mat& templ, InspectorWidgetMatchRecord& record, double& minVal, double& maxVal, cv::Point& matchLoc, double& matchVal);
+    bool matchDirtyRegions(InspectorWidgetFrameContext& ctx, size_t index, cv::Rect region, cv::Mat& templ, InspectorWidgetMatchRecord& record, double& minVal, double& maxVal, cv::Point& matchLoc, double& matchVal);
+    /// Result windows of ref, a view into a gray pyramid level, where the mean and deviation of the template can be reached
+    void prefilterWindows(InspectorWidgetFrameContext& ctx, size_t index, const cv::Mat& ref, int level, std::vector<cv::Rect>& windows);
+    /// First occurrence in raster order of the gray template in frame, found by 2D rolling hash and confirmed pixel by pixel
+    bool matchExact(InspectorWidgetFrameContext& ctx, size_t index, const cv::Mat& frame, cv::Point& matchLoc);
+    void updateIntegrals(InspectorWidgetFrameContext& ctx, int level);
+    /// Correlates the cached template spectrum with the frame spectrum of its level, normalized into res like cv::matchTemplate
+    void matchSpectrum(InspectorWidgetFrameContext& ctx, size_t index, cv::Mat& res);
+    bool framesAreIndependent();
+    bool computeComputerVisionPipeline();
+    bool computeComputerVisionShards();
+    bool computeComputerVisionBisection();
+    std::vector<bool> templatePresence(InspectorWidgetFrameResult& result);
+
+    float getSetting(std::string key, float value, std::string name = "");
+
+    void addStatistic(std::string key, double value);
+    double getStatistic(std::string key);
+    /// Interned statistics are slots of the statistics map, zeroed but never erased between runs
+    double* internStatistic(std::string key);
+    void addStatistic(double* statistic, double value);
+    void benchmarkMatchTemplate(std::string name, cv::Mat& frame, cv::Mat& templ, cv::Point matchLoc, double time);
+    void benchmarkNccKernel(std::string name, const cv::Mat& ref, const cv::Mat& templ);
+    void reportStatistics();
+    std::map<std::string,double> statistics;
+    std::mutex statistics_mutex;
+    double* run_statistics[STAT_RUN_COUNT];
+
+    /// Initialized Tesseract engines per OCR type, each one used by a single analysis at a time
+    tesseract::TessBaseAPI* acquireOcrEngine(std::string type);
+    void releaseOcrEngine(std::string type, tesseract::TessBaseAPI* engine);
+    std::map<std::string,std::vector<tesseract::TessBaseAPI*> > ocr_engines;
+    std::mutex ocr_engines_mutex;
+
+    /// Least recently used OCR results, most recent first, indexed by hash of type and pixels
+    uint64 hashOcrImage(std::string type, const cv::Mat& image);
+    bool lookupOcrCache(std::string type, const cv::Mat& image, std::string& text);
+    void storeOcrCache(std::string type, const cv::Mat& image, std::string text);
+    bool loadOcrCache(std::string path);
+    bool saveOcrCache(std::string path);
+    std::list<InspectorWidgetOcrCacheEntry> ocr_cache;
+    std::map<uint64,std::list<InspectorWidgetOcrCacheEntry>::iterator> ocr_cache_index;
+    std::mutex ocr_cache_mutex;
+
+    /// OCR worker pool, jobs are recognized inline when it has no workers
+    void recognizeText(InspectorWidgetOcrJob& job);
+    void recognizeTextBatch(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >& jobs);
+    bool recognizeQuickly(InspectorWidgetOcrJob& job, std::string& text);
+    bool useGlyphs(InspectorWidgetOcrJob& job);
+    void finishText(InspectorWidgetOcrJob& job, std::string text);
+    std::string recognizeTesseract(std::string type, const cv::Mat& image, int* confidence);
+    bool recognizeGlyphs(InspectorWidgetOcrJob& job, std::string& text);
+    void learnGlyphs(InspectorWidgetOcrJob& job, std::string text, int confidence);
+    /// Glyphs learned for each OCR type of the annotation table, replaced rather than modified when glyphs are learned
+    std::vector<std::shared_ptr<const std::map<char,cv::Mat> > > glyph_templates;
+    std::mutex glyphs_mutex;
+    void submitOcrJobs(std::vector<std::shared_ptr<InspectorWidgetOcrJob> >& jobs);
+    void waitOcrJob(std::shared_ptr<InspectorWidgetOcrJob> job);
+    void startOcrWorkers(int workers, int max_in_flight);
+    void stopOcrWorkers();
+    std::vector<std::thread> ocr_workers;
+    std::deque<std::shared_ptr<InspectorWidgetOcrJob> > ocr_jobs;
+    std::mutex ocr_jobs_mutex;
+    std::condition_variable ocr_jobs_condition;
+    int ocr_jobs_in_flight;
+    int ocr_jobs_max_in_flight;
+    bool ocr_jobs_stop;
+
+    /// Keyframe index of each video, kept in a sidecar index next to it, null if the video could not be indexed
+    std::shared_ptr<const InspectorWidgetKeyframeIndex> indexKeyframes(std::string videopath, int frames);
+    bool buildKeyframeIndex(std::string videopath, InspectorWidgetKeyframeIndex& index);
+    bool loadKeyframeIndex(std::string path, int64 videosize, int frames, InspectorWidgetKeyframeIndex& index);
+    bool saveKeyframeIndex(std::string path, int64 videosize, const InspectorWidgetKeyframeIndex& index);
+    int nearestKeyframe(const InspectorWidgetKeyframeIndex* keyframes, int frame);
+    /// Seeks capture from position to target using the keyframes and costs of its own video
+    bool seekFrame(cv::VideoCapture& capture, int& position, int target, InspectorWidgetSeekState& state);
+    std::map<std::string,std::shared_ptr<const InspectorWidgetKeyframeIndex> > keyframe_indexes;
+    std::mutex keyframe_indexes_mutex;
+
+    /// Long-lived capture and least recently used decoded frames, most recent first, shared by template extractions
+    bool openFrameCapture(std::string videopath, int& width, int& height, int& frames, float& fps);
+    bool readCachedFrame(std::string videopath, int frame, cv::Mat& image);
+    void clearFrameCache();
+    cv::VideoCapture frame_capture;
+    std::string frame_capture_video;
+    int frame_capture_position;
+    InspectorWidgetSeekState frame_capture_seek;
+    std::list<std::pair<int,cv::Mat> > frame_cache;
+    std::map<int,std::list<std::pair<int,cv::Mat> >::iterator> frame_cache_index;
+    std::mutex frame_cache_mutex;
+
+    /// Measured costs of seeking and of decoding one frame forward, updated by all captures of the analysis
+    void updateSeekCost(double& cost, int& samples, double time);
+    InspectorWidgetSeekState cap_seek;
+    std::mutex seek_cost_mutex;
 
     cv::Mat img;
     cv::Mat dst;
     cv::Mat ref_gray, tpl_gray;
     std::map<std::string,cv::Mat> templates;
     std::map<std::string,cv::Mat> gray_templates;
+    std::map<std::string,std::vector<cv::Mat> > gray_template_pyramids;
+    int fastmatchlevels;
+    int analysislevels;
     std::map<std::string, float > template_x,template_y,template_val;
     std::map<std::string, std::vector<float> > template_vals;
     std::map<std::string, int> template_w,template_h;
@@ -256,7 +719,7 @@ protected:
 
     std::string datapath;
     std::string videostem;
-    cv::VideoCapture cap;
+    InspectorWidgetLumaCapture cap;
 
     int frame;
     int csv_frame;
@@ -297,6 +760,7 @@ protected:
     std::vector<std::string> supported_accessibility_actions;
     std::vector<std::string> supported_input_hook_tests;
     std::vector<std::string> supported_input_hook_actions;
+    std::vector<std::string> supported_setting_actions;
 
     std::list<std::string> template_matching_logged_dep_list;
     std::map<std::string,std::vector<std::string> > template_matching_logged_dep_map;
@@ -351,6 +815,24 @@ protected:
 
     std::map<std::string,float> annotation_progress;
 
+    std::map<std::string,std::string> settings;
+    std::map<std::string,std::map<std::string,std::string> > annotation_settings;
+
+    /// Global settings read for each frame, region or seek, refreshed whenever settings change
+    void internSettings();
+    bool ocr_batch;
+    int ocr_batch_size;
+    int ocr_cache_size;
+    float seek_latency;  // Cost of a seek in decoded frames, negative to assume a group of pictures
+    bool adaptive_seek;
+    int frame_cache_size;
+
+    /// Resolves annotation names, dependencies, settings and output slots once templates are loaded
+    void internAnnotations();
+    InspectorWidgetAnnotationTable annotation_table;
+
+    InspectorWidgetFrameContext frame_context;
+
     InspectorWidget::Annotations annotations;
 public:
     void resetAnnotationProgress(std::string name,InspectorWidget::SourceType source_type,InspectorWidget::AnnotationTemporalType temporal_type,InspectorWidget::AnnotationValueType value_type);
@@ -0,0 +1,96 @@
+/**
+ * @file InspectorWidgetNccKernelTest.cpp
+ * @brief Checks that each level of the vectorized NCC kernel scores like cv::matchTemplate, and times them
+ * @author Christian Frisson
+ */
+
+#include "InspectorWidgetNccKernel.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <iostream>
+#include <cmath>
+
+/// Largest difference of scores accepted between the kernel and cv::matchTemplate
+const double tolerance = 1e-3;
+
+/// Scores tpl over ref at the given kernel level, returning the largest difference with cv::matchTemplate, or -1 if the kernel refused
+double compareLevel(const cv::Mat& ref, const cv::Mat& tpl, const cv::Mat& sums, const cv::Mat& sqsums, InspectorWidgetNccKernelLevel level, double& ticks){
+    cv::Mat expected, actual;
+    cv::matchTemplate(ref, tpl, expected, cv::TM_CCOEFF_NORMED);
+    int64 start = cv::getTickCount();
+    if(!matchTemplateNcc(ref, tpl, actual, sums, sqsums, cv::Point(0,0), level)){
+        return -1;
+    }
+    ticks += cv::getTickCount() - start;
+    if(actual.size() != expected.size() || actual.type() != expected.type()){
+        return 2;
+    }
+    double error = 0;
+    for(int y = 0; y < expected.rows; y++){
+        const float* e = expected.ptr<float>(y);
+        const float* a = actual.ptr<float>(y);
+        for(int x = 0; x < expected.cols; x++){
+            error = std::max(error, (double)std::fabs(e[x] - a[x]));
+        }
+    }
+    return error;
+}
+
+int main( int argc, char** argv )
+{
+    /// Wide enough for rows of results longer than a chunk of the kernel
+    cv::RNG rng(1234);
+    cv::Mat ref(120, 320, CV_8UC1);
+    rng.fill(ref, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::GaussianBlur(ref, ref, cv::Size(5,5), 0);
+    cv::Mat sums, sqsums;
+    cv::integral(ref, sums, sqsums, CV_64F);
+
+    /// Template sides up to the largest the kernel handles, odd widths pairing their last pixel with zeros
+    int sides[] = {1, 2, 3, 5, 8, 15, 16, 17, 31, 32, 33, 47, 63, 64};
+    int count = sizeof(sides)/sizeof(sides[0]);
+
+    InspectorWidgetNccKernelLevel best = nccKernelLevel();
+    std::vector<double> ticks(best + 1, 0);
+    bool passed = true;
+    for(int _w = 0; _w < count; _w++){
+        for(int _h = 0; _h < count; _h++){
+            int w = sides[_w], h = sides[_h];
+            /// A noisy crop of the image, so that scores spread over the whole range
+            cv::Mat tpl = ref(cv::Rect(rng.uniform(0, ref.cols - w + 1), rng.uniform(0, ref.rows - h + 1), w, h)).clone();
+            cv::Mat noise(h, w, CV_8UC1);
+            rng.fill(noise, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(16));
+            tpl += noise;
+            for(int level = NCC_KERNEL_SCALAR; level <= best; level++){
+                double error = compareLevel(ref, tpl, sums, sqsums, (InspectorWidgetNccKernelLevel)level, ticks[level]);
+                if(error < 0 || error > tolerance){
+                    std::cerr << nccKernelName((InspectorWidgetNccKernelLevel)level) << " kernel ";
+                    if(error < 0){
+                        std::cerr << "refused a " << w << "x" << h << " template" << std::endl;
+                    }
+                    else{
+                        std::cerr << "differs from cv::matchTemplate by " << error << " for a " << w << "x" << h << " template" << std::endl;
+                    }
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    /// Flat templates match everywhere at every level
+    cv::Mat flat(9, 7, CV_8UC1, cv::Scalar(128));
+    for(int level = NCC_KERNEL_SCALAR; level <= best; level++){
+        cv::Mat res;
+        if(!matchTemplateNcc(ref, flat, res, sums, sqsums, cv::Point(0,0), (InspectorWidgetNccKernelLevel)level) || cv::countNonZero(res != 1) > 0){
+            std::cerr << nccKernelName((InspectorWidgetNccKernelLevel)level) << " kernel does not match a flat template everywhere" << std::endl;
+            passed = false;
+        }
+    }
+
+    std::cout << "Templates of " << count*count << " sizes up to " << ncc_kernel_max_size << "x" << ncc_kernel_max_size << " on a " << ref.cols << "x" << ref.rows << " image:" << std::endl;
+    for(int level = NCC_KERNEL_SCALAR; level <= best; level++){
+        std::cout << "  " << nccKernelName((InspectorWidgetNccKernelLevel)level) << ": " << ticks[level]*1000/cv::getTickFrequency() << " ms" << std::endl;
+    }
+    std::cout << (passed ? "All kernel levels match cv::matchTemplate" : "Some kernel levels differ from cv::matchTemplate") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file InspectorWidgetProcessorPipelineTest.cpp
+ * @brief Checks that the pipelined analysis writes the same CSV and JSON files as the serial analysis, for independent and dependent annotations
+ * @author Christian Frisson
+ */
+
+#include "InspectorWidgetProcessor.h"
+
+#include <sstream>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+
+/// Fixture video named with its start date and time, as recordings are
+const std::string videostem = "2016-01-01-10-00-00";
+const int frames = 40;
+const int fps = 10;
+
+bool makeDirectory(std::string path){
+#ifdef WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+}
+
+/// Noisy background with a patterned box and a label attached to its right moving across it,
+/// a number drawn below that changes every 10 frames, and the clock timestamps of the frames
+bool writeFixture(std::string datapath){
+    cv::Size size(160,120);
+#if CV_MAJOR_VERSION >= 3
+    int fourcc = cv::VideoWriter::fourcc('m','p','4','v');
+#else
+    int fourcc = CV_FOURCC('m','p','4','v');
+#endif
+    cv::VideoWriter video(datapath + videostem + ".mp4", fourcc, fps, size, true);
+    if(!video.isOpened()){
+        std::cerr << "Could not write fixture video in " << datapath << std::endl;
+        return false;
+    }
+    cv::RNG rng(1234);
+    cv::Mat background(size, CV_8UC3);
+    rng.fill(background, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(96));
+    cv::Mat box(24, 32, CV_8UC3);
+    rng.fill(box, cv::RNG::UNIFORM, cv::Scalar::all(128), cv::Scalar::all(256));
+    cv::Mat label(24, 16, CV_8UC3);
+    rng.fill(label, cv::RNG::UNIFORM, cv::Scalar::all(64), cv::Scalar::all(192));
+    for(int f = 0; f < frames; f++){
+        cv::Mat frame = background.clone();
+        /// The box leaves the frame for the last frames so that the templates are also absent
+        if(f < frames - 8){
+            box.copyTo(frame(cv::Rect(8 + 2*f, 16 + f, box.cols, box.rows)));
+            label.copyTo(frame(cv::Rect(8 + 2*f + box.cols, 16 + f, label.cols, label.rows)));
+        }
+        cv::Rect caption(0, 88, size.width, 32);
+        frame(caption).setTo(cv::Scalar::all(255));
+        std::stringstream number;
+        number << 100 + 11*(f/10);
+        cv::putText(frame, number.str(), cv::Point(8, 112), cv::FONT_HERSHEY_SIMPLEX, 0.8, cv::Scalar::all(0), 2);
+        video << frame;
+    }
+
+    std::ofstream timestamps((datapath + videostem + ".tsv").c_str());
+    if(!timestamps.is_open()){
+        std::cerr << "Could not write fixture timestamps in " << datapath << std::endl;
+        return false;
+    }
+    unsigned long long start = 1451642400000000000ULL;
+    for(int f = 0; f < frames; f++){
+        unsigned long long time = (unsigned long long)f*1000000000ULL/fps;
+        timestamps << f << "\t" << time << "\t" << start + time << std::endl;
+    }
+    return true;
+}
+
+/// Annotations of one case, and the names of the files they write
+struct PipelineCase {
+    std::string name;
+    std::vector<std::string> annotations;
+    std::vector<std::string> outputs;
+};
+
+/// Runs the analysis of the fixture in datapath with the given number of pipeline workers, 0 for the serial path
+bool analyze(std::string datapath, std::string workers, const PipelineCase& test){
+    if(!makeDirectory(datapath) || !writeFixture(datapath)){
+        return false;
+    }
+    std::vector<std::string> args;
+    args.push_back(datapath);
+    args.push_back(videostem + ".mp4");
+    args.push_back("set(workers," + workers + ")");
+    args.push_back("set(shards,1)");
+    args.push_back("set(bisectionStep,0)");
+    args.insert(args.end(), test.annotations.begin(), test.annotations.end());
+
+    InspectorWidgetProcessor processor;
+    processor.init(args);
+    if(!processor.getStatusError().empty()){
+        std::cerr << "Analysis of case '" << test.name << "' with " << workers << " worker(s) failed: " << processor.getStatusError() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// Compares two output files line by line, reporting the first difference
+bool compareFiles(std::string expected, std::string actual){
+    std::ifstream e(expected.c_str()), a(actual.c_str());
+    if(!e.is_open()){
+        return true;
+    }
+    if(!a.is_open()){
+        std::cerr << actual << " was not written" << std::endl;
+        return false;
+    }
+    std::string e_line, a_line;
+    int line = 1;
+    while(true){
+        bool e_read = (bool)std::getline(e, e_line);
+        bool a_read = (bool)std::getline(a, a_line);
+        if(!e_read && !a_read){
+            return true;
+        }
+        if(e_read != a_read || e_line != a_line){
+            std::cerr << actual << " differs from " << expected << " at line " << line << ":" << std::endl;
+            std::cerr << "  serial:    " << (e_read ? e_line : "<end of file>") << std::endl;
+            std::cerr << "  pipelined: " << (a_read ? a_line : "<end of file>") << std::endl;
+            return false;
+        }
+        line++;
+    }
+}
+
+int main( int argc, char** argv )
+{
+#ifdef WIN32
+    std::string slash("\\");
+#else
+    std::string slash("/");
+#endif
+    std::string root = argc > 1 ? std::string(argv[1]) + slash : std::string("");
+
+    /// Cases where frames might depend on previously analyzed ones: anchored templates, tracking windows and text regions
+    std::string box = "Box = template(0.05,0.13,0.2,0.2," + videostem + ".mp4,0)";
+    std::string label = "Label = template(0.25,0.13,0.1,0.2," + videostem + ".mp4,0)";
+    std::vector<PipelineCase> cases(4);
+    cases[0].name = "independent";
+    cases[0].annotations.push_back(box);
+    cases[0].annotations.push_back("inrect(0,0,160,120){matchTemplate(Box)}");
+    cases[0].outputs.push_back("+Box.csv");
+    cases[1].name = "rightof";
+    cases[1].annotations.push_back(box);
+    cases[1].annotations.push_back(label);
+    cases[1].annotations.push_back("inrect(0,0,160,120){matchTemplate(Box)}");
+    cases[1].annotations.push_back("rightof(Box){matchTemplate(Label)}");
+    cases[1].outputs.push_back("+Box+Label.csv");
+    cases[1].outputs.push_back("_Label.csv");
+    cases[1].outputs.push_back("-Label-segments.json");
+    cases[1].outputs.push_back("-Label-overlays.json");
+    cases[2].name = "tracking";
+    cases[2].annotations.push_back("set(tracking,1)");
+    cases[2].annotations.push_back(box);
+    cases[2].annotations.push_back("inrect(0,0,160,120){matchTemplate(Box)}");
+    cases[2].outputs.push_back("+Box.csv");
+    cases[3].name = "text";
+    cases[3].annotations.push_back(box);
+    cases[3].annotations.push_back("inrect(0,0,160,120){matchTemplate(Box)}");
+    cases[3].annotations.push_back("inrect(0,88,160,32){detectNumber(Caption)}");
+    cases[3].outputs.push_back("+Box+Caption.csv");
+    cases[3].outputs.push_back("_Caption.csv");
+    cases[3].outputs.push_back("-Caption-segments.json");
+    cases[3].outputs.push_back("-Caption-overlays.json");
+    /// Outputs of the box are written in every case
+    for(size_t _c = 0; _c < cases.size(); _c++){
+        cases[_c].outputs.push_back("_Box.csv");
+        cases[_c].outputs.push_back("-Box-segments.json");
+        cases[_c].outputs.push_back("-Box-overlays.json");
+    }
+
+    bool same = true;
+    for(size_t _c = 0; _c < cases.size(); _c++){
+        const PipelineCase& test = cases[_c];
+        std::string serial = root + "pipeline-" + test.name + "-serial" + slash;
+        std::string pipelined = root + "pipeline-" + test.name + "-pipelined" + slash;
+        if(!analyze(serial,"0",test) || !analyze(pipelined,"3",test)){
+            return 1;
+        }
+
+        /// Outputs missing from the serial run are not compared
+        int compared = 0;
+        bool case_same = true;
+        for(std::vector<std::string>::const_iterator _o = test.outputs.begin(); _o != test.outputs.end(); _o++){
+            std::string output = videostem + *_o;
+            std::ifstream written((serial + output).c_str());
+            if(written.is_open()){
+                compared++;
+            }
+            case_same &= compareFiles(serial + output, pipelined + output);
+        }
+        if(compared == 0){
+            std::cerr << "The serial analysis of case '" << test.name << "' wrote no output" << std::endl;
+            return 1;
+        }
+        std::cout << "Case '" << test.name << "': " << (case_same ? "serial and pipelined outputs match" : "serial and pipelined outputs differ") << " (" << compared << " files compared)" << std::endl;
+        same &= case_same;
+    }
+    return same ? 0 : 1;
+}